@@ -0,0 +1,46 @@
+#!/bin/sh
+# make bench: allocator calls of the shell for a batch of typical command
+# lines, and wall time for a batch of built-in lines (see the arena in src/arena.c). Run another build
+# with SHELL_BIN=path/to/shell.out make bench to compare.
+set -e
+
+here=$(cd "$(dirname "$0")" && pwd)
+shell=${SHELL_BIN:-$here/../shell.out}
+lines=${BENCH_LINES:-1000}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+printf 'pear\napple\npear\nfig\n' > "$work/fruit"
+
+# One round is 4 lines: a redirect, a 3-stage pipeline, a ; list and a
+# pipeline fed by <
+i=0
+while [ "$i" -lt "$lines" ]; do
+    echo "echo line $i > out"
+    echo "echo a b c | cat | wc -w"
+    echo "echo one ; echo two ; echo three"
+    echo "cat < fruit | sort | uniq"
+    i=$((i + 4))
+done > "$work/mixed"
+
+# Intrinsics only (src/intrinsics.c), so no line spawns a process: what the
+# shell itself spends per line. echo is not one of them.
+i=0
+while [ "$i" -lt "$((lines * 8))" ]; do
+    echo "hop ."
+    echo "hash"
+    echo "maxjobs"
+    echo "plancache"
+    i=$((i + 4))
+done > "$work/builtins"
+
+cd "$work"
+echo "$lines mixed lines:"
+LD_PRELOAD="$here/malloc_count.so" "$shell" < mixed 2>&1 >/dev/null | grep '^malloc '
+rm -f .shell_history*
+
+echo "$((lines * 8)) built-in lines:"
+start=$(date +%s%N)
+"$shell" < builtins > /dev/null 2>&1
+end=$(date +%s%N)
+echo "wall $(( (end - start) / 1000000 )) ms"
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump-pointer allocator: everything allocated from an arena is released
+// together by arena_release()/arena_reset(), never one by one
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+typedef struct {
+    arena_block_t *first;
+    arena_block_t *current;
+    size_t block_size;  // default size of a new block
+} arena_t;
+
+// A position in an arena to roll back to (allows nested users of one arena)
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+// Function declarations
+void arena_init(arena_t *arena, size_t block_size);
+void *arena_alloc(arena_t *arena, size_t size);
+void *arena_calloc(arena_t *arena, size_t count, size_t size);
+char *arena_strndup(arena_t *arena, const char *s, size_t len);
+arena_mark_t arena_mark(arena_t *arena);
+void arena_release(arena_t *arena, arena_mark_t mark);
+void arena_reset(arena_t *arena);
+void arena_destroy(arena_t *arena);
+
+#endif // ARENA_H
@@ -0,0 +1,52 @@
+#ifndef AST_H
+#define AST_H
+
+#include "arena.h"
+
+// Parsed form of one input line, built by parser.c in a single pass and
+// walked directly by executor.c
+
+// Redirection kinds
+typedef enum {
+    REDIR_INPUT,   // < name
+    REDIR_OUTPUT,  // > name
+    REDIR_APPEND   // >> name
+} redirect_type_t;
+
+typedef struct redirect {
+    redirect_type_t type;
+    char *target;
+    struct redirect *next;      // next redirection, in source order
+} redirect_t;
+
+// atomic -> name (name | input | output)*
+typedef struct atomic {
+    char **argv;                // NULL terminated
+    int argc;
+    redirect_t *redirects;
+    struct atomic *next;        // next stage of the pipeline
+} atomic_t;
+
+// cmd_group -> atomic (| atomic)*
+typedef struct pipeline {
+    atomic_t *stages;
+    int nstages;
+    int background;             // cmd_group was followed by '&'
+    struct pipeline *next;      // next cmd_group of the line
+} pipeline_t;
+
+// shell_cmd -> cmd_group ((& | ;) cmd_group)* &?
+typedef struct {
+    pipeline_t *pipelines;
+    int npipelines;
+} shell_ast_t;
+
+// Cached plan for one input line (see plancache.c)
+typedef struct plan_entry plan_entry_t;
+
+// Function declarations
+shell_ast_t *parse_shell_ast(const char *input, arena_t *arena);
+shell_ast_t *plan_acquire(const char *input, arena_t *fallback, plan_entry_t **entry_out);
+void plan_release(plan_entry_t *entry);
+
+#endif // AST_H
@@ -2,49 +2,128 @@
 #define BG_JOBS_H
 
 #include <sys/types.h>
-
-#define MAX_JOBS 100
-#define MAX_CMD_LEN 256
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stddef.h>
+#include <time.h>
+#include "cgroup.h"
+#include "watchdog.h"
 
 // Job status types
 typedef enum {
     JOB_RUNNING,
     JOB_STOPPED,
-    JOB_DONE
+    JOB_DONE,
+    JOB_QUEUED      // waiting for a slot, nothing spawned yet (see queue_job)
 } job_status_t;
 
-// Structure to track background jobs
+// How a job_launch_fn is asked to run its queued job
+enum {
+    JOB_LAUNCH_DROP,             // never run it, just release arg
+    JOB_LAUNCH_BACKGROUND,       // spawn it as a background job (add_job_members)
+    JOB_LAUNCH_FOREGROUND        // run it to completion (or Ctrl-Z) on the terminal
+};
+
+// Spawns a queued job or just releases arg, as run (JOB_LAUNCH_*) says
+typedef void (*job_launch_fn)(void *arg, int run);
+
+struct bg_job;
+// Takes over the completion of a job started by a built-in (see add_task_job);
+// returns 1 if it printed anything
+typedef int (*job_exit_fn)(const struct bg_job *job, void *arg);
+
+// Resources used by a job, summed over its members as wait4() reaps them
 typedef struct {
-    int job_id;
+    struct timeval utime;        // user CPU time
+    struct timeval stime;        // system CPU time
+    long maxrss;                 // KiB, largest of any member
+    long nvcsw;                  // voluntary context switches
+    long nivcsw;                 // involuntary context switches
+    long inblock;                // block input operations
+    long oublock;                // block output operations
+    struct timespec started;     // CLOCK_MONOTONIC, when the job was launched
+    struct timespec ended;       // when its last member was reaped, zero until then
+} job_usage_t;
+
+// One process of a job (a pipeline stage)
+typedef struct job_proc {
     pid_t pid;
-    pid_t pgid;  // Process group ID
-    char command[MAX_CMD_LEN];
-    int active;
+    int pidfd;              // watched by the event loop, -1 once reaped or if unavailable
+    const char *name;       // interned stage name
     job_status_t status;
+    int wait_status;        // how it ended, once JOB_DONE
+    struct bg_job *job;
+    struct job_proc *pid_next;  // pid index chain (live members only)
+} job_proc_t;
+
+// Structure to track background jobs
+typedef struct bg_job {
+    int job_id;
+    pid_t pid;   // first member, leads the process group
+    pid_t pgid;  // Process group ID
+    const char *command;  // interned, see intern.c
+    job_status_t status;  // stopped once any member stops
+    struct bg_job *prev, *next;  // all jobs in job-id order
+    struct bg_job *id_next;      // job-id index chain
+    job_usage_t usage;           // of the members reaped so far
+    int nlive;                   // members not reaped yet
+    int nprocs;
+    job_proc_t *procs;           // in pipeline order, none while queued
+    job_launch_fn launch;        // queued jobs only
+    void *launch_arg;
+    struct bg_job *queue_next;   // FIFO of queued jobs
+    job_exit_fn on_exit;         // NULL: completion is reported as usual
+    void *exit_arg;
+    job_cgroup_t *cgroup;        // limit ... jobs only, removed with the job
+    job_watchdog_t *watchdog;    // timeout ... jobs only, disarmed with the job
 } bg_job_t;
 
+// How a finished job ended, kept for wait (see find_job_result)
+typedef struct {
+    int job_id;
+    const char *command;
+    int wait_status;             // of its last stage
+    int timed_out;
+    job_usage_t usage;
+    unsigned long seq;           // completion order, from 1; 0 = unused
+} job_result_t;
+
 // Global variables for signal handling
 extern pid_t foreground_pid;
 extern pid_t foreground_pgid;
 
 // Function declarations
 void init_bg_jobs(void);
-void check_background_processes(void);
+int job_child_status(pid_t pid, int status, const struct rusage *usage);
 int add_background_job(pid_t pid, const char* command);
+int add_job_members(pid_t pgid, const pid_t *pids, const char *const *names,
+                    const int *statuses, const struct rusage *usages, int n,
+                    job_status_t status, const struct timespec *started);
+int format_job_usage(const bg_job_t *job, char *buf, size_t size);
+int format_usage(const job_usage_t *usage, char *buf, size_t size);
+const job_result_t *find_job_result(int job_id);
+const job_result_t *job_result(unsigned long seq);
+unsigned long last_result_seq(void);
+int jobs_pending(void);
+int job_slot_available(void);
+int queue_job(const char *command, job_launch_fn launch, void *arg);
+int add_task_job(pid_t pid, const char *command, job_exit_fn on_exit, void *arg);
+int set_shell_stdout(int fd);
+int get_shell_stdout(void);
 void remove_background_job(pid_t pid);
 int has_background_ampersand(const char* input);
 char* remove_trailing_ampersand(const char* input);
 int get_active_job_count(void);
-void get_job_info(int index, pid_t *pid, char *command, int *status);
-int find_job_by_number(int job_number);
-int get_most_recent_job(void);
-int get_job_number(int job_index);
-void resume_job(int job_index);
-void bring_job_to_foreground(int job_index);
+bg_job_t *first_job(void);
+bg_job_t *find_job_by_number(int job_number);
+bg_job_t *find_job_by_pid(pid_t pid);
+job_proc_t *find_job_proc(pid_t pid);
+bg_job_t *get_most_recent_job(void);
+void resume_job(bg_job_t *job);
+void bring_job_to_foreground(bg_job_t *job);
 void cleanup_all_jobs(void);
 
 // Signal handling functions
-void setup_signal_handling(void);
 void sigint_handler(int sig);
 void sigtstp_handler(int sig);
 void set_foreground_process(pid_t pid, pid_t pgid);
@@ -0,0 +1,27 @@
+#ifndef CGROUP_H
+#define CGROUP_H
+
+// Per-job resource limits (limit --cpu/--mem). A limited job gets a child
+// cgroup of the shell's own (cgroup v2) with cpu.max/memory.max set; where
+// the shell's cgroup is not delegated to it the limits fall back to
+// setrlimit/nice in each of the job's processes.
+
+typedef struct job_cgroup job_cgroup_t;
+
+typedef struct {
+    int cpu_percent;               // share of one CPU, 0 = unlimited
+    unsigned long long mem_bytes;  // 0 = unlimited
+    job_cgroup_t *cgroup;          // NULL: fall back to per-process limits
+} job_limits_t;
+
+// Function declarations
+int parse_limits(int argc, char **argv, job_limits_t *limits);
+job_cgroup_t *cgroup_create(const job_limits_t *limits);
+int cgroup_fd(const job_cgroup_t *cgroup);
+int cgroup_stats(const job_cgroup_t *cgroup, unsigned long long *mem_current,
+                 unsigned long long *cpu_usec);
+void cgroup_release(job_cgroup_t *cgroup);
+void cgroup_shutdown(void);
+void limit_command(int argc, char **argv);
+
+#endif // CGROUP_H
@@ -0,0 +1,36 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// The shell's single event loop: epoll over stdin, a signalfd for
+// SIGCHLD/SIGINT/SIGTSTP and a timerfd. Job state changes are handled
+// as soon as they happen, whether the shell is at the prompt or
+// waiting for a foreground job.
+
+// A one-shot timer; the callback returns 1 if it printed anything
+typedef struct loop_timer loop_timer_t;
+typedef int (*loop_timer_fn)(void *arg);
+
+// A watched fd is readable (or hung up); returns 1 if it printed anything
+typedef int (*loop_fd_fn)(int fd, void *arg);
+
+// Condition for loop_wait_until()
+typedef int (*loop_done_fn)(void *arg);
+
+// Function declarations
+int loop_init(void);
+int loop_is_owner(void);
+int loop_watch_pid(pid_t pid);
+int loop_wait_stdin(void);
+void loop_dispatch_pending(void);
+int loop_expect_foreground(const pid_t *pids, int npids, int *statuses, struct rusage *usages);
+int loop_wait_foreground(const pid_t *pids, int npids, int *statuses, struct rusage *usages);
+loop_timer_t *loop_add_timer(unsigned long ms, loop_timer_fn fn, void *arg);
+void loop_cancel_timer(loop_timer_t *timer);
+int loop_watch_fd(int fd, loop_fd_fn fn, void *arg);
+void loop_unwatch_fd(int fd);
+int loop_wait_until(loop_done_fn done, void *arg);
+
+#endif // EVENTLOOP_H
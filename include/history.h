@@ -0,0 +1,38 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+// Command history store behind log. Commands go to an append-only journal
+// (.shell_history, one binary record each) and the byte offset of every
+// record to a fixed-width index (.shell_history.idx). Both files are mapped,
+// so record n is found and read in O(1) however long the history is, and
+// nothing is read into memory at startup. Shells started in the same
+// directory share the history; history_sync merges in what the others appended.
+
+#define HISTORY_STATUS_UNKNOWN -1
+
+// One history record: the command line and how running it went
+typedef struct {
+    long long start_us;            // wall clock time it was entered, 0 = unknown
+    unsigned long duration_ms;     // wall time until the shell was back at the prompt
+    int status;                    // $?-style exit status of its last foreground cmd_group
+    int job_id;                    // last job it started (or stopped), 0 = none
+    const char *command;
+    size_t command_len;
+    const char *cwd;               // directory it ran in, NULL/empty = unknown
+    size_t cwd_len;
+} history_entry_t;
+
+// Function declarations
+void history_open(const char *journal_path);
+void history_sync(void);
+long history_count(void);
+int history_read(long n, history_entry_t *entry);
+void history_append(const history_entry_t *entry);
+long history_search(const char *pattern, long before, long *matches, long max);
+void history_flush(void);
+void history_purge(void);
+void add_to_history(const char *command, const history_entry_t *info);
+
+#endif // HISTORY_H
@@ -0,0 +1,7 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+// Function declarations
+const char *intern(const char *s);
+
+#endif // INTERN_H
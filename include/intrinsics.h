@@ -0,0 +1,24 @@
+#ifndef INTRINSICS_H
+#define INTRINSICS_H
+
+// Registry of the shell's built-in commands. The executor decides
+// where a built-in runs (shell process, forked child) from its flags only.
+
+typedef void (*intrinsic_fn)(int argc, char **argv);
+
+// Capability flags
+#define INTRINSIC_PARENT      0x1  // acts on the shell itself (terminal, job table): never in a child
+#define INTRINSIC_PIPE_SAFE   0x2  // may run inside the shell process as a pipeline stage
+#define INTRINSIC_READS_STDIN 0x4  // consumes stdin: inside the shell only when fed by spawned stages
+#define INTRINSIC_PREFIX      0x8  // modifies the cmd_group it starts, applied by the executor
+
+typedef struct {
+    const char *name;
+    intrinsic_fn fn;
+    unsigned flags;
+} intrinsic_t;
+
+// Function declarations
+const intrinsic_t *find_intrinsic(const char *name);
+
+#endif // INTRINSICS_H
@@ -0,0 +1,17 @@
+#ifndef JOBLOG_H
+#define JOBLOG_H
+
+// Captured output of background jobs. With capture on (joblog on) a
+// background job's stdout and stderr go to a pipe the shell drains into a
+// bounded ring buffer per job, instead of onto the terminal; output beyond
+// the ring spills to an unlinked temporary file. joblog <job> dumps it.
+
+typedef struct job_output job_output_t;
+
+// Function declarations
+job_output_t *joblog_open(int *write_fd);
+void joblog_bind(job_output_t *out, int job_id);
+void joblog_discard(job_output_t *out);
+void joblog_command(int argc, char **argv);
+
+#endif // JOBLOG_H
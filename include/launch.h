@@ -0,0 +1,27 @@
+#ifndef LAUNCH_H
+#define LAUNCH_H
+
+#include <sys/types.h>
+
+// How a new process should be wired up before it runs
+typedef struct {
+    int stdin_fd;          // pipe end or open '<' target dup2'd onto stdin, -1 to inherit
+    int stdout_fd;         // pipe end or open '>' target dup2'd onto stdout, -1 to inherit
+    int stderr_fd;         // dup2'd onto stderr (captured job output), -1 to inherit
+    pid_t pgid;            // process group to join, 0 = lead a new group
+    int foreground;        // hand the terminal to the process group
+    int background;        // read stdin from /dev/null
+    int cgroup_fd;         // cgroup directory to start the process in, -1 = the shell's
+    unsigned long long mem_limit;  // RLIMIT_AS in bytes, 0 = unlimited
+    int nice;              // niceness increment
+} launch_opts_t;
+
+// Function declarations
+void launch_opts_init(launch_opts_t *opts);
+int launch_command(const char *path, char *const argv[], const launch_opts_t *opts, pid_t *pid_out);
+pid_t launch_fork(const launch_opts_t *opts);
+int open_pidfd(pid_t pid);
+int signal_process(int pidfd, pid_t pid, int sig);
+int signal_group(int pidfd, pid_t pgid, int sig);
+
+#endif // LAUNCH_H
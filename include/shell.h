@@ -37,13 +37,14 @@ int skip_whitespace(const char *str, int start);
 
 // Command execution
 int execute_command(const char *input);
+const char *lookup_command_path(const char *name);
 
 // History
 void load_history(void);
 
 // Input redirection functions
 char* extract_input_redirect(const char *input, char **clean_command);
-int setup_input_redirection(const char *filename);
+int setup_input_redirection(int fd);
 
 void hop(int argc, char **argv);
 void reveal(int argc, char **argv);
@@ -52,6 +53,10 @@ void activities(int argc, char **argv);
 void ping(int argc, char **argv);
 void fg(int argc, char **argv);
 void bg(int argc, char **argv);
-void add_to_history(const char *command);
+void hash_command(int argc, char **argv);
+void plancache_command(int argc, char **argv);
+void maxjobs_command(int argc, char **argv);
+void parallel_command(int argc, char **argv);
+void wait_command(int argc, char **argv);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,18 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+
+#include <stdint.h>
+
+// Persistent trigram index over the history's commands (.shell_history.tri),
+// behind log search. Every three-byte sequence of a command hashes to one of
+// a fixed set of buckets; each bucket holds the numbers of the records with
+// such a trigram, newest first. A query only visits the records found in the
+// buckets of all of its own trigrams, newest first, and checks those.
+// Callers hold the history lock (see history.c).
+
+// Function declarations
+int trigram_update(const char *path, uint64_t journal_ino, long records, int build);
+long trigram_search(const char *pattern, long before, long *matches, long max);
+void trigram_close(void);
+
+#endif // TRIGRAM_H
@@ -0,0 +1,22 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// Deadlines of timeout ... commands. When one expires the job's process group
+// gets SIGTERM (and SIGCONT, should it be stopped), then SIGKILL if it is
+// still around after the grace period. Every watchdog is a timer in the
+// event loop's heap, so there is no helper process per command.
+
+typedef struct job_watchdog job_watchdog_t;
+
+// Function declarations
+int parse_timeout(int argc, char **argv, unsigned long *timeout_ms, unsigned long *grace_ms);
+job_watchdog_t *watchdog_start(pid_t pgid, unsigned long timeout_ms, unsigned long grace_ms);
+int watchdog_expired(const job_watchdog_t *watchdog);
+int format_timeout(const job_watchdog_t *watchdog, char *buf, size_t size);
+void watchdog_release(job_watchdog_t *watchdog);
+void timeout_command(int argc, char **argv);
+
+#endif // WATCHDOG_H
@@ -1,19 +1,43 @@
+#define _GNU_SOURCE
 #include "shell.h"
+#include "bg_jobs.h"
+#include "eventloop.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
-#include <signal.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+// The job table is kept current by the event loop, so the list of processes
+// comes from walking it; nothing is signalled or waited for here. What the
+// table cannot know (scheduler state, CPU, RSS, age) comes from one read of
+// /proc/<pid>/stat per process. A member is only listed until it is reaped,
+// so its pid cannot have been reused for another process yet.
+
+#define STAT_BUF_SIZE 1024
 
 // Structure to hold process information for sorting
 typedef struct {
-    pid_t pid;
-    char command_name[256];
+    pid_t pid;                 // 0 for a queued job
+    const char *command_name;  // interned, owned by the job table
     char state[32];
+    const bg_job_t *job;
+    int sampled;               // the fields below were read from /proc
+    char sched_state;          // R, S, D, T, Z ...
+    unsigned long long ticks;  // user + system CPU, in clock ticks
+    unsigned long long start;  // start time, clock ticks after boot
+    long rss_pages;
 } process_info_t;
 
+// CPU ticks each pid had at the previous refresh of activities -w
+typedef struct {
+    pid_t pid;
+    unsigned long long ticks;
+} cpu_sample_t;
+
 // Compare function for qsort (lexicographical by command name)
 static int compare_processes(const void *a, const void *b) {
     const process_info_t *proc_a = (const process_info_t *)a;
@@ -21,94 +45,258 @@ static int compare_processes(const void *a, const void *b) {
     return strcmp(proc_a->command_name, proc_b->command_name);
 }
 
-// Check if a process is still running
-static int is_process_running(pid_t pid) {
-    if (kill(pid, 0) == 0) {
-        // Process exists, check if it's stopped
-        int status;
-        pid_t result = waitpid(pid, &status, WNOHANG);
-        if (result == 0) {
-            // Process is still running
-            return 1;
-        } else if (result > 0 && WIFSTOPPED(status)) {
-            // Process is stopped
-            return 2;
-        } else {
-            // Process has terminated
-            return 0;
-        }
-    }
-    return 0; // Process doesn't exist
+static int compare_samples(const void *a, const void *b) {
+    pid_t pa = ((const cpu_sample_t *)a)->pid, pb = ((const cpu_sample_t *)b)->pid;
+    return (pa > pb) - (pa < pb);
 }
 
-void activities(int argc, char **argv) {
-    (void)argc; // Suppress unused parameter warning
-    (void)argv;
-    
-    // Get the list of background jobs from bg_jobs
-    extern int get_active_job_count(void);
-    extern void get_job_info(int index, pid_t *pid, char *command, int *status);
-    
-    int job_count = get_active_job_count();
-    
-    if (job_count == 0) {
-       // printf("No background processes running.\n");
+// Fill in a process's state, CPU time, start time and RSS from /proc/<pid>/stat
+static void sample_process(process_info_t *proc) {
+    char path[64], buf[STAT_BUF_SIZE];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)proc->pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
         return;
     }
-    
-    // Collect process information
-    process_info_t *processes = malloc(job_count * sizeof(process_info_t));
+    buf[n] = '\0';
+
+    // pid (comm) state ...: comm may hold spaces and parentheses, so fields
+    // are counted from its last ')'
+    char *p = strrchr(buf, ')');
+    if (!p) {
+        return;
+    }
+    unsigned long long utime, stime, start;
+    long rss;
+    if (sscanf(p + 2, "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %*d %*d %llu %*u %ld",
+               &proc->sched_state, &utime, &stime, &start, &rss) != 5) {
+        return;
+    }
+    proc->ticks = utime + stime;
+    proc->start = start;
+    proc->rss_pages = rss;
+    proc->sampled = 1;
+}
+
+// Every live process of every job gets an entry, a queued job one as well.
+// Returns the number collected into *out (malloc'd), -1 on error
+static int collect_processes(process_info_t **out) {
+    int proc_total = 0;
+    for (bg_job_t *job = first_job(); job; job = job->next) {
+        proc_total += job->status == JOB_QUEUED ? 1 : job->nlive;
+    }
+    *out = NULL;
+    if (proc_total == 0) {
+        return 0;
+    }
+
+    process_info_t *processes = calloc((size_t)proc_total, sizeof(process_info_t));
     if (!processes) {
         perror("malloc");
-        return;
+        return -1;
     }
-    
+
     int valid_count = 0;
-    
-    // Check each job and collect valid ones
-    for (int i = 0; i < job_count; i++) {
-        pid_t pid;
-        char command[256];
-        int status;
-        
-        get_job_info(i, &pid, command, &status);
-        
-        if (pid > 0) {
-            int running_state = is_process_running(pid);
-            
-            if (running_state > 0) {
-                // Process is still active
-                processes[valid_count].pid = pid;
-                strncpy(processes[valid_count].command_name, command, 255);
-                processes[valid_count].command_name[255] = '\0';
-                
-                if (running_state == 1) {
-                    strcpy(processes[valid_count].state, "Running");
-                } else {
-                    strcpy(processes[valid_count].state, "Stopped");
-                }
-                
-                valid_count++;
+    for (bg_job_t *job = first_job(); job; job = job->next) {
+        if (job->status == JOB_QUEUED) {
+            processes[valid_count].pid = 0;
+            processes[valid_count].command_name = job->command;
+            processes[valid_count].job = job;
+            strcpy(processes[valid_count].state, "Queued");
+            valid_count++;
+            continue;
+        }
+        for (int i = 0; i < job->nprocs; i++) {
+            const job_proc_t *proc = &job->procs[i];
+            if (proc->status == JOB_DONE) {
+                continue;
             }
+            processes[valid_count].pid = proc->pid;
+            processes[valid_count].command_name = proc->name;
+            processes[valid_count].job = job;
+            strcpy(processes[valid_count].state,
+                   proc->status == JOB_STOPPED ? "Stopped" : "Running");
+            sample_process(&processes[valid_count]);
+            valid_count++;
         }
     }
-    
-    if (valid_count == 0) {
-        printf("No background processes running.\n");
-        free(processes);
-        return;
+    *out = processes;
+    return valid_count;
+}
+
+// CPU% over the last interval where a previous sample exists, else over the
+// process's lifetime
+static double cpu_percent(const process_info_t *proc, double uptime, long hz,
+                          const cpu_sample_t *prev, int nprev, double interval) {
+    cpu_sample_t key = { proc->pid, 0 };
+    const cpu_sample_t *last = prev ? bsearch(&key, prev, (size_t)nprev, sizeof(cpu_sample_t),
+                                              compare_samples) : NULL;
+    if (last && interval > 0 && proc->ticks >= last->ticks) {
+        return 100.0 * (double)(proc->ticks - last->ticks) / (double)hz / interval;
     }
-    
+    double age = uptime - (double)proc->start / (double)hz;
+    return age > 0 ? 100.0 * (double)proc->ticks / (double)hz / age : 0.0;
+}
+
+// Print the collected processes (sorted by name). prev holds the CPU ticks
+// of the previous refresh, if any
+static void print_processes(process_info_t *processes, int count, int verbose,
+                            const cpu_sample_t *prev, int nprev, double interval) {
+    struct timespec now;
+    clock_gettime(CLOCK_BOOTTIME, &now);
+    double uptime = (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+    long hz = sysconf(_SC_CLK_TCK);
+    long page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
     // Sort processes lexicographically by command name
-    qsort(processes, valid_count, sizeof(process_info_t), compare_processes);
-    
+    qsort(processes, (size_t)count, sizeof(process_info_t), compare_processes);
+
     // Display processes in required format: [pid] : command_name - State
-    for (int i = 0; i < valid_count; i++) {
-        printf("[%d] : %s - %s\n", 
-               processes[i].pid, 
-               processes[i].command_name, 
-               processes[i].state);
+    for (int i = 0; i < count; i++) {
+        const process_info_t *proc = &processes[i];
+        if (proc->pid == 0) {
+            printf("[-] : %s - %s", proc->command_name, proc->state);
+        } else {
+            printf("[%d] : %s - %s", proc->pid, proc->command_name, proc->state);
+        }
+        if (proc->sampled) {
+            long elapsed = (long)(uptime - (double)proc->start / (double)hz);
+            printf("  (%c, cpu %.1f%%, rss %ldK, %02ld:%02ld:%02ld)", proc->sched_state,
+                   cpu_percent(proc, uptime, hz, prev, nprev, interval),
+                   proc->rss_pages * page_kb, elapsed / 3600, elapsed / 60 % 60, elapsed % 60);
+        }
+        // limit ... jobs: what their cgroup has charged so far
+        unsigned long long mem, cpu_usec;
+        if (proc->job->cgroup && cgroup_stats(proc->job->cgroup, &mem, &cpu_usec) == 0) {
+            printf("  {mem %lluK cpu %llu.%02llus}", mem / 1024,
+                   cpu_usec / 1000000, cpu_usec % 1000000 / 10000);
+        }
+        if (verbose) {
+            char usage[160];
+            format_job_usage(proc->job, usage, sizeof(usage));
+            printf("  [job %d: %s]", proc->job->job_id, usage);
+        }
+        printf("\n");
+    }
+}
+
+// State of activities -w between refreshes
+typedef struct {
+    unsigned long interval_ms;
+    int verbose;
+    int due;                   // the timer fired: refresh
+    cpu_sample_t *prev;        // sorted by pid
+    int nprev;
+} watch_t;
+
+static int watch_tick(void *arg) {
+    ((watch_t *)arg)->due = 1;
+    return 0;
+}
+
+static int watch_due(void *arg) {
+    return ((watch_t *)arg)->due;
+}
+
+// Redraw the list in place, then remember every process's CPU ticks.
+// Returns -1 once the output can no longer be written (e.g. a closed pipe)
+static int refresh(watch_t *watch) {
+    process_info_t *processes;
+    int count = collect_processes(&processes);
+    if (count < 0) {
+        return -1;
+    }
+
+    time_t wall = time(NULL);
+    struct tm tm;
+    localtime_r(&wall, &tm);
+    printf("\033[H\033[2J"); // home, clear screen
+    printf("Every %lu.%lus: activities  %02d:%02d:%02d  (Ctrl-C to stop)\n\n",
+           watch->interval_ms / 1000, watch->interval_ms % 1000 / 100,
+           tm.tm_hour, tm.tm_min, tm.tm_sec);
+    print_processes(processes, count, watch->verbose, watch->prev, watch->nprev,
+                    (double)watch->interval_ms / 1000.0);
+    int rc = fflush(stdout) == 0 && !ferror(stdout) ? 0 : -1;
+    clearerr(stdout);
+
+    cpu_sample_t *samples = count ? malloc((size_t)count * sizeof(cpu_sample_t)) : NULL;
+    int nsamples = 0;
+    for (int i = 0; samples && i < count; i++) {
+        if (processes[i].sampled) {
+            samples[nsamples].pid = processes[i].pid;
+            samples[nsamples++].ticks = processes[i].ticks;
+        }
+    }
+    if (samples) {
+        qsort(samples, (size_t)nsamples, sizeof(cpu_sample_t), compare_samples);
+    }
+    free(watch->prev);
+    watch->prev = samples;
+    watch->nprev = nsamples;
+    free(processes);
+    return rc;
+}
+
+// Refresh every interval_ms on the event loop's timer until Ctrl-C; jobs keep
+// being reaped (and vanish from the list) meanwhile, their notices going to
+// the shell's stdout rather than into a redirected view
+static void watch_activities(unsigned long interval_ms, int verbose) {
+    watch_t watch = { interval_ms, verbose, 0, NULL, 0 };
+    while (refresh(&watch) == 0) {
+        watch.due = 0;
+        loop_timer_t *timer = loop_add_timer(interval_ms, watch_tick, &watch);
+        if (!timer) {
+            break; // no loop here (a forked child): one snapshot
+        }
+        if (loop_wait_until(watch_due, &watch) == -1) {
+            if (!watch.due) {
+                loop_cancel_timer(timer); // Ctrl-C before it fired
+            }
+            break;
+        }
+    }
+    free(watch.prev);
+}
+
+// activities            list the live processes of all jobs
+// activities -v         also show each job's resource accounting (see format_job_usage)
+// activities -w <secs>  live view, redrawn every <secs> seconds until Ctrl-C
+// Jobs started under limit also show their cgroup's memory.current and CPU time
+void activities(int argc, char **argv) {
+    int verbose = 0;
+    unsigned long interval_ms = 0;
+    for (int i = 1; i < argc; i++) {
+        char *end = NULL;
+        double secs = 0;
+        if (strcmp(argv[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc &&
+                   (secs = strtod(argv[i + 1], &end)) >= 0.1 && *end == '\0' && secs <= 86400) {
+            interval_ms = (unsigned long)(secs * 1000);
+            i++;
+        } else {
+            fprintf(stderr, "Usage: activities [-v] [-w seconds]\n");
+            return;
+        }
     }
-    
+
+    if (interval_ms) {
+        watch_activities(interval_ms, verbose);
+        return;
+    }
+
+    process_info_t *processes;
+    int count = collect_processes(&processes);
+    if (count <= 0) {
+       // printf("No background processes running.\n");
+        return;
+    }
+    print_processes(processes, count, verbose, NULL, 0, 0);
+    fflush(stdout);
     free(processes);
-} 
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// arena allocator for transient per-command-line data (AST, argv, stage tables)
+// blocks are kept after a release and reused, so a typical line costs no malloc at all
+
+#define ARENA_ALIGN sizeof(void*)
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static arena_block_t *new_block(size_t size) {
+    arena_block_t *block = malloc(sizeof(arena_block_t) + size);
+    if (!block) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void arena_init(arena_t *arena, size_t block_size) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    size = align_up(size ? size : 1);
+
+    arena_block_t *block = arena->current;
+    if (block && block->size - block->used >= size) {
+        void *p = block->data + block->used;
+        block->used += size;
+        return p;
+    }
+
+    // Move on to a kept block that is big enough, or chain in a new one
+    while (block && block->next) {
+        block = block->next;
+        block->used = 0;
+        if (block->size >= size) {
+            arena->current = block;
+            block->used = size;
+            return block->data;
+        }
+    }
+
+    arena_block_t *fresh = new_block(size > arena->block_size ? size : arena->block_size);
+    if (!fresh) return NULL;
+    if (block) {
+        block->next = fresh;
+    } else {
+        arena->first = fresh;
+    }
+    arena->current = fresh;
+    fresh->used = size;
+    return fresh->data;
+}
+
+void *arena_calloc(arena_t *arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void *p = arena_alloc(arena, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+char *arena_strndup(arena_t *arena, const char *s, size_t len) {
+    char *copy = arena_alloc(arena, len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+arena_mark_t arena_mark(arena_t *arena) {
+    arena_mark_t mark;
+    mark.block = arena->current;
+    mark.used = arena->current ? arena->current->used : 0;
+    return mark;
+}
+
+// Free everything allocated after mark; the memory stays with the arena
+void arena_release(arena_t *arena, arena_mark_t mark) {
+    if (!mark.block) {
+        arena_reset(arena);
+        return;
+    }
+    arena->current = mark.block;
+    mark.block->used = mark.used;
+}
+
+void arena_reset(arena_t *arena) {
+    arena->current = arena->first;
+    if (arena->first) {
+        arena->first->used = 0;
+    }
+}
+
+void arena_destroy(arena_t *arena) {
+    arena_block_t *block = arena->first;
+    while (block) {
+        arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
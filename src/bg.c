@@ -1,4 +1,5 @@
 #include "shell.h"
+#include "bg_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,33 +10,27 @@ void bg(int argc, char **argv) {
     
     if (argc == 1) {
         // No job number provided, use most recent job
-        extern int get_most_recent_job(void);
-        int job_index = get_most_recent_job();
+        bg_job_t *job = get_most_recent_job();
         
-        if (job_index == -1) {
+        if (!job) {
             printf("No background jobs\n");
             return;
         }
         
-        // Get job info
-        extern void get_job_info(int index, pid_t *pid, char *command, int *status);
-        pid_t pid;
-        char command[256];
-        int status;
-        get_job_info(job_index, &pid, command, &status);
-        
-        if (status == 0) { // JOB_RUNNING = 0
+        if (job->status == JOB_RUNNING) {
             printf("Job already running\n");
             return;
         }
         
-        // Resume the job
-        extern void resume_job(int job_index);
-        resume_job(job_index);
+        // Resume the job (a queued one is started, and dropped if that fails)
+        int job_id = job->job_id;
+        const char *command = job->command;
+        resume_job(job);
+        if (!find_job_by_number(job_id)) {
+            return;
+        }
         
         // Print success message
-        extern int get_job_number(int job_index);
-        int job_id = get_job_number(job_index);
         fprintf(stderr, "[%d] %s &\n", job_id, command);
         fflush(stderr);
         
@@ -50,29 +45,24 @@ void bg(int argc, char **argv) {
         }
         
         // Find job by number
-        extern int find_job_by_number(int job_number);
-        int job_index = find_job_by_number(job_number);
+        bg_job_t *job = find_job_by_number(job_number);
         
-        if (job_index == -1) {
+        if (!job) {
             printf("No such job\n");
             return;
         }
         
-        // Get job info
-        extern void get_job_info(int index, pid_t *pid, char *command, int *status);
-        pid_t pid;
-        char command[256];
-        int status;
-        get_job_info(job_index, &pid, command, &status);
-        
-        if (status == 0) { // JOB_RUNNING = 0
+        if (job->status == JOB_RUNNING) {
             printf("Job already running\n");
             return;
         }
         
-        // Resume the job
-        extern void resume_job(int job_index);
-        resume_job(job_index);
+        // Resume the job (a queued one is started, and dropped if that fails)
+        const char *command = job->command;
+        resume_job(job);
+        if (!find_job_by_number(job_number)) {
+            return;
+        }
         
         // Print success message
         printf("[%d] %s &\n", job_number, command);
@@ -80,4 +70,4 @@ void bg(int argc, char **argv) {
     } else {
         printf("Usage: bg [job_number]\n");
     }
-} 
\ No newline at end of file
+} 
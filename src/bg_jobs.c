@@ -3,81 +3,628 @@
 #include <string.h>
 
 #include "bg_jobs.h"
+#include "eventloop.h"
+#include "launch.h"
+#include "intern.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/wait.h>
+#include <errno.h>
 #include <ctype.h>
 #include <termios.h>
 
-// Global variables for background job tracking
-static bg_job_t bg_jobs[MAX_JOBS];
+// Background job table. Jobs live in individually allocated records (stable
+// pointers) linked in job-id order, so the newest job is always the tail. Each
+// job owns its member processes, one per pipeline stage; live members are
+// indexed by pid and jobs by job id in hash tables that grow with the table:
+// every lookup is O(1) no matter how many jobs are running.
+
+#define JOB_MIN_BUCKETS 64
+#define JOB_RESULTS_KEPT 64
+
+static bg_job_t *jobs_head = NULL;  // oldest job
+static bg_job_t *jobs_tail = NULL;  // most recent job
+static job_proc_t **pid_buckets = NULL;
+static bg_job_t **id_buckets = NULL;
+static size_t bucket_count = 0;      // power of two, shared by both indexes
 static int next_job_id = 1;
 static int job_count = 0;
+static int proc_count = 0;           // live members across all jobs
+
+// Scheduler: at most max_jobs background jobs run at once (0 = no limit);
+// the rest wait, oldest first, in a FIFO threaded through the job list
+static int max_jobs = 0;             // set from the online CPUs by init_bg_jobs()
+static int running_jobs = 0;
+static int running_tasks = 0;        // task jobs (add_task_job), outside the limit
+static bg_job_t *queue_head = NULL;
+static bg_job_t *queue_tail = NULL;
+static bg_job_t *admitting = NULL;   // queued job being launched, filled in by add_job()
+
+// The shell's own stdout while a built-in runs the event loop with fd 1
+// redirected (wait > f, joblog -f 1 | ...): job notices and the jobs admitted
+// meanwhile go there, not into the built-in's file or pipe. -1 = fd 1 itself
+static int shell_stdout = -1;
+
+// The most recent completions, for wait: a ring indexed by seq
+static job_result_t results[JOB_RESULTS_KEPT];
+static unsigned long result_seq = 0;
 
 // Global variables for signal handling
 pid_t foreground_pid = 0;
 pid_t foreground_pgid = 0;
 
+static size_t bucket_of(unsigned key) {
+    key ^= key >> 16;
+    key *= 0x45d9f3bu;
+    key ^= key >> 16;
+    return key & (bucket_count - 1);
+}
+
+static void proc_index_insert(job_proc_t *proc) {
+    size_t b = bucket_of((unsigned)proc->pid);
+    proc->pid_next = pid_buckets[b];
+    pid_buckets[b] = proc;
+}
+
+static void proc_index_remove(job_proc_t *proc) {
+    job_proc_t **pp = &pid_buckets[bucket_of((unsigned)proc->pid)];
+    while (*pp && *pp != proc) pp = &(*pp)->pid_next;
+    if (*pp) *pp = proc->pid_next;
+}
+
+static void id_index_insert(bg_job_t *job) {
+    size_t b = bucket_of((unsigned)job->job_id);
+    job->id_next = id_buckets[b];
+    id_buckets[b] = job;
+}
+
+static void id_index_remove(bg_job_t *job) {
+    bg_job_t **pp = &id_buckets[bucket_of((unsigned)job->job_id)];
+    while (*pp && *pp != job) pp = &(*pp)->id_next;
+    if (*pp) *pp = job->id_next;
+}
+
+// Double both indexes; see reserve_indexes()
+static int grow_indexes(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : JOB_MIN_BUCKETS;
+    job_proc_t **new_pid = calloc(new_count, sizeof(job_proc_t *));
+    bg_job_t **new_id = calloc(new_count, sizeof(bg_job_t *));
+    if (!new_pid || !new_id) {
+        free(new_pid);
+        free(new_id);
+        return -1;
+    }
+    free(pid_buckets);
+    free(id_buckets);
+    pid_buckets = new_pid;
+    id_buckets = new_id;
+    bucket_count = new_count;
+    for (bg_job_t *job = jobs_head; job; job = job->next) {
+        id_index_insert(job);
+        for (int i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].status != JOB_DONE) {
+                proc_index_insert(&job->procs[i]);
+            }
+        }
+    }
+    return 0;
+}
+
+// Make room for that many more jobs and live members: both indexes
+// grow once either would hold more than one entry per bucket, so queued jobs
+// (which have no members) still get an O(1) id lookup. -1 if there are no
+// buckets at all; a failed growth only means longer chains
+static int reserve_indexes(int jobs, int procs) {
+    while (job_count + jobs > (int)bucket_count || proc_count + procs > (int)bucket_count) {
+        if (grow_indexes() == -1) break;
+    }
+    return bucket_count ? 0 : -1;
+}
+
+static void add_timeval(struct timeval *sum, const struct timeval *tv) {
+    sum->tv_sec += tv->tv_sec;
+    sum->tv_usec += tv->tv_usec;
+    if (sum->tv_usec >= 1000000) {
+        sum->tv_sec++;
+        sum->tv_usec -= 1000000;
+    }
+}
+
+// Fold one reaped member's rusage into its job's totals
+static void account_usage(job_usage_t *total, const struct rusage *ru) {
+    add_timeval(&total->utime, &ru->ru_utime);
+    add_timeval(&total->stime, &ru->ru_stime);
+    if (ru->ru_maxrss > total->maxrss) {
+        total->maxrss = ru->ru_maxrss;
+    }
+    total->nvcsw += ru->ru_nvcsw;
+    total->nivcsw += ru->ru_nivcsw;
+    total->inblock += ru->ru_inblock;
+    total->oublock += ru->ru_oublock;
+}
+
+// Give a job its place in the list (as the most recent one) and in the id index
+static void link_job(bg_job_t *job) {
+    job->job_id = next_job_id++;
+    job->prev = jobs_tail;
+    if (jobs_tail) {
+        jobs_tail->next = job;
+    } else {
+        jobs_head = job;
+    }
+    jobs_tail = job;
+    id_index_insert(job);
+    job_count++;
+}
+
+static void unlink_job(bg_job_t *job) {
+    id_index_remove(job);
+    if (job->prev) job->prev->next = job->next; else jobs_head = job->next;
+    if (job->next) job->next->prev = job->prev; else jobs_tail = job->prev;
+    job_count--;
+}
+
+// Every status change goes through here so the running count stays exact.
+// A built-in's task jobs (on_exit set) run in the built-in's own slots and
+// leave maxjobs's to the & jobs
+static void set_job_status(bg_job_t *job, job_status_t status) {
+    int *running = job->on_exit ? &running_tasks : &running_jobs;
+    if (job->status == JOB_RUNNING) (*running)--;
+    if (status == JOB_RUNNING) (*running)++;
+    job->status = status;
+}
+
+// The descriptor job notices and admitted jobs should use as stdout while a
+// built-in has fd 1 redirected, -1 when it is fd 1. Returns the previous one
+int set_shell_stdout(int fd) {
+    int previous = shell_stdout;
+    shell_stdout = fd;
+    return previous;
+}
+
+int get_shell_stdout(void) {
+    return shell_stdout;
+}
+
+// Point fd 1 back at the shell's own stdout for a while. Returns what to hand
+// to leave_shell_stdout(): the built-in's redirected stdout, -1 if none
+static int enter_shell_stdout(void) {
+    if (shell_stdout == -1) {
+        return -1;
+    }
+    fflush(stdout);
+    int redirected = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    if (redirected != -1 && dup2(shell_stdout, STDOUT_FILENO) == -1) {
+        close(redirected);
+        redirected = -1;
+    }
+    return redirected;
+}
+
+static void leave_shell_stdout(int redirected) {
+    if (redirected == -1) {
+        return;
+    }
+    fflush(stdout);
+    dup2(redirected, STDOUT_FILENO);
+    close(redirected);
+}
+
+// Create a job from the processes of one pipeline and link it in as the most
+// recent one, or fill in the queued job being admitted. Entries with pid <= 0
+// (stages that never ran) are left out; statuses (optional) marks members
+// that already exited with != -1, and usages then holds what they used.
+// started defaults to now; on_exit (optional) makes it a built-in's task job
+static bg_job_t *add_job(pid_t pgid, const pid_t *pids, const char *const *names,
+                         const int *statuses, const struct rusage *usages, int n,
+                         job_status_t status, const struct timespec *started,
+                         job_exit_fn on_exit, void *exit_arg) {
+    int nprocs = 0, nlive = 0;
+    for (int i = 0; i < n; i++) {
+        if (pids[i] <= 0) continue;
+        nprocs++;
+        if (!statuses || statuses[i] == -1) nlive++;
+    }
+    if (nlive == 0) {
+        return NULL;
+    }
+    if (reserve_indexes(admitting ? 0 : 1, nlive) == -1) {
+        return NULL;
+    }
+
+    bg_job_t *job = admitting ? admitting : calloc(1, sizeof(bg_job_t));
+    job_proc_t *procs = calloc((size_t)nprocs, sizeof(job_proc_t));
+    if (!job || !procs) {
+        if (job != admitting) free(job);
+        free(procs);
+        return NULL;
+    }
+    for (int i = 0, k = 0; i < n; i++) {
+        if (pids[i] <= 0) continue;
+        job_proc_t *proc = &procs[k++];
+        proc->pid = pids[i];
+        proc->name = intern(names[i]);
+        proc->job = job;
+        if (!proc->name) {
+            if (job != admitting) free(job);
+            free(procs);
+            return NULL;
+        }
+        if (statuses && statuses[i] != -1) {
+            proc->status = JOB_DONE;
+            proc->wait_status = statuses[i];
+            proc->pidfd = -1;
+            if (usages) {
+                account_usage(&job->usage, &usages[i]);
+            }
+        } else {
+            proc->status = status;
+            proc->pidfd = -2; // watched once the job is linked in
+        }
+    }
+
+    if (job == admitting) {
+        admitting = NULL; // keeps its job id and place in the list
+    } else {
+        job->status = JOB_DONE; // not counted as running until set below
+        link_job(job);
+    }
+    job->procs = procs;
+    job->pid = procs[0].pid;
+    job->pgid = pgid > 0 ? pgid : job->pid;
+    job->command = procs[0].name;
+    job->on_exit = on_exit;
+    job->exit_arg = exit_arg;
+    set_job_status(job, status);
+    job->nprocs = nprocs;
+    job->nlive = nlive;
+    if (started) {
+        job->usage.started = *started;
+    } else {
+        clock_gettime(CLOCK_MONOTONIC, &job->usage.started);
+    }
+
+    for (int i = 0; i < nprocs; i++) {
+        job_proc_t *proc = &procs[i];
+        if (proc->status != JOB_DONE) {
+            proc->pidfd = loop_watch_pid(proc->pid);
+            proc_index_insert(proc);
+        }
+    }
+    proc_count += nlive;
+    return job;
+}
+
+// A member is gone: stop watching it and take it out of the pid index, so a
+// reused pid can never be mistaken for it. usage is NULL when it was not reaped
+static void retire_proc(job_proc_t *proc, int wait_status, const struct rusage *usage) {
+    if (proc->status == JOB_DONE) {
+        return;
+    }
+    proc_index_remove(proc);
+    if (proc->pidfd >= 0) {
+        close(proc->pidfd);
+    }
+    proc->pidfd = -1;
+    proc->status = JOB_DONE;
+    proc->wait_status = wait_status;
+    if (usage) {
+        account_usage(&proc->job->usage, usage);
+    }
+    if (--proc->job->nlive == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &proc->job->usage.ended);
+    }
+    proc_count--;
+}
+
+// Take a queued job out of the FIFO
+static void dequeue_job(bg_job_t *job) {
+    bg_job_t **pp = &queue_head;
+    while (*pp && *pp != job) pp = &(*pp)->queue_next;
+    if (!*pp) return;
+    *pp = job->queue_next;
+    if (queue_tail == job) {
+        queue_tail = NULL;
+        for (bg_job_t *q = queue_head; q; q = q->queue_next) queue_tail = q;
+    }
+    job->queue_next = NULL;
+}
+
+// Unlink a job from the list and both indexes and free it. A queued job's
+// pipeline is discarded without running
+static void drop_job(bg_job_t *job) {
+    if (job->status == JOB_QUEUED) {
+        dequeue_job(job);
+        job->launch(job->launch_arg, JOB_LAUNCH_DROP);
+    }
+    for (int i = 0; i < job->nprocs; i++) {
+        retire_proc(&job->procs[i], 0, NULL);
+    }
+    set_job_status(job, JOB_DONE);
+    unlink_job(job);
+    cgroup_release(job->cgroup);
+    watchdog_release(job->watchdog);
+    free(job->procs);
+    free(job);
+}
+
+// Launch a queued job now. Returns 0 if it is running, -1 if nothing could be
+// started (the job is then gone)
+static int start_queued_job(bg_job_t *job) {
+    dequeue_job(job);
+    job->status = JOB_DONE; // no longer queued: launch() fills it in via add_job()
+    admitting = job;
+    job->launch(job->launch_arg, JOB_LAUNCH_BACKGROUND);
+    if (admitting == job) {
+        // Not a single stage could be spawned
+        admitting = NULL;
+        drop_job(job);
+        return -1;
+    }
+    return 0;
+}
+
+// Start queued jobs, oldest first, while there are free slots. They inherit
+// the shell's own stdout, whatever the built-in running right now redirected
+static void admit_queued_jobs(void) {
+    static int admitting_now = 0;
+    if (admitting_now || !queue_head || (max_jobs != 0 && running_jobs >= max_jobs)) {
+        return;
+    }
+    admitting_now = 1;
+    int redirected = enter_shell_stdout();
+    while (queue_head && (max_jobs == 0 || running_jobs < max_jobs)) {
+        start_queued_job(queue_head);
+    }
+    leave_shell_stdout(redirected);
+    admitting_now = 0;
+}
+
+// True if a new background job may start right away: a slot is free and no
+// older job is waiting for one
+int job_slot_available(void) {
+    return !queue_head && (max_jobs == 0 || running_jobs < max_jobs);
+}
+
+// Put a background command on hold until a slot frees up; launch(arg,
+// JOB_LAUNCH_BACKGROUND) then spawns it (and must register it with
+// add_job_members()), launch(arg, JOB_LAUNCH_FOREGROUND) runs it in the
+// foreground for fg, while launch(arg, JOB_LAUNCH_DROP) just releases arg if
+// the job is dropped first.
+// Returns the job id or -1
+int queue_job(const char *command, job_launch_fn launch, void *arg) {
+    if (reserve_indexes(1, 0) == -1) {
+        return -1;
+    }
+    bg_job_t *job = calloc(1, sizeof(bg_job_t));
+    const char *name = intern(command);
+    if (!job || !name) {
+        free(job);
+        return -1;
+    }
+    job->command = name;
+    job->status = JOB_QUEUED;
+    job->launch = launch;
+    job->launch_arg = arg;
+    clock_gettime(CLOCK_MONOTONIC, &job->usage.started);
+    link_job(job);
+    if (queue_tail) {
+        queue_tail->queue_next = job;
+    } else {
+        queue_head = job;
+    }
+    queue_tail = job;
+
+    fprintf(stderr, "[%d] queued\n", job->job_id);
+    fflush(stderr);
+    return job->job_id;
+}
+
+// maxjobs       show the limit on running background jobs and how many run / wait
+//               (task jobs of parallel have their own limit and are shown apart)
+// maxjobs <n>   set it (0 = no limit); raising it starts queued jobs at once
+void maxjobs_command(int argc, char **argv) {
+    if (argc == 1) {
+        int queued = 0;
+        for (bg_job_t *job = queue_head; job; job = job->queue_next) queued++;
+        if (max_jobs == 0) {
+            printf("unlimited (%d running, %d queued", running_jobs, queued);
+        } else {
+            printf("%d (%d running, %d queued", max_jobs, running_jobs, queued);
+        }
+        if (running_tasks > 0) {
+            printf(", %d parallel tasks outside the limit", running_tasks);
+        }
+        printf(")\n");
+        fflush(stdout);
+        return;
+    }
+    char *end;
+    long n = argc == 2 ? strtol(argv[1], &end, 10) : -1;
+    if (argc != 2 || *argv[1] == '\0' || *end != '\0' || n < 0 || n > 1000000) {
+        fprintf(stderr, "Usage: maxjobs [n]\n");
+        return;
+    }
+    max_jobs = (int)n;
+    admit_queued_jobs();
+}
+
+// Any live member's pidfd, to signal the job's process group through
+static int job_pidfd(const bg_job_t *job) {
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].pidfd >= 0) {
+            return job->procs[i].pidfd;
+        }
+    }
+    return -1;
+}
+
+// One line of accounting: wall time (so far, for a job still running), CPU
+// times, peak RSS, context switches and block I/O. Returns snprintf's result
+int format_job_usage(const bg_job_t *job, char *buf, size_t size) {
+    return format_usage(&job->usage, buf, size);
+}
+
+// The same for any usage record; one that has not ended counts up to now
+int format_usage(const job_usage_t *u, char *buf, size_t size) {
+    struct timespec end = u->ended;
+    if (end.tv_sec == 0 && end.tv_nsec == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    double real = (double)(end.tv_sec - u->started.tv_sec) +
+                  (double)(end.tv_nsec - u->started.tv_nsec) / 1e9;
+
+    return snprintf(buf, size, "real %.2fs user %ld.%02lds sys %ld.%02lds maxrss %ldK csw %ld/%ld io %ld/%ld",
+                    real,
+                    (long)u->utime.tv_sec, (long)u->utime.tv_usec / 10000,
+                    (long)u->stime.tv_sec, (long)u->stime.tv_usec / 10000,
+                    u->maxrss, u->nvcsw, u->nivcsw, u->inblock, u->oublock);
+}
+
+// Print how a finished job ended and what it used. A pipeline lists every
+// stage's status; a job its deadline ended says so
+static void report_completion(const bg_job_t *job, int normally) {
+    int timed_out = watchdog_expired(job->watchdog);
+    printf("%s with pid %d exited %s", job->command, job->pid,
+           normally && !timed_out ? "normally" : "abnormally");
+    if (timed_out) {
+        char why[64];
+        format_timeout(job->watchdog, why, sizeof(why));
+        printf(": %s", why);
+    }
+    if (job->nprocs > 1) {
+        for (int i = 0; i < job->nprocs; i++) {
+            const job_proc_t *proc = &job->procs[i];
+            printf("%s%s: ", i ? " | " : " (", proc->name);
+            if (WIFSIGNALED(proc->wait_status)) {
+                printf("signal %d", WTERMSIG(proc->wait_status));
+            } else {
+                printf("%d", WEXITSTATUS(proc->wait_status));
+            }
+        }
+        printf(")");
+    }
+    char usage[160];
+    format_job_usage(job, usage, sizeof(usage));
+    printf(" [%s]\n", usage);
+    fflush(stdout);
+}
+
+// Keep how a job ended for wait
+static void record_result(const bg_job_t *job) {
+    job_result_t *result = &results[++result_seq % JOB_RESULTS_KEPT];
+    result->job_id = job->job_id;
+    result->command = job->command;
+    result->wait_status = job->procs[job->nprocs - 1].wait_status;
+    result->timed_out = watchdog_expired(job->watchdog);
+    result->usage = job->usage;
+    result->seq = result_seq;
+}
+
+// Newest result of job job_id, if it is still kept
+const job_result_t *find_job_result(int job_id) {
+    for (unsigned long i = 0; i < JOB_RESULTS_KEPT && i < result_seq; i++) {
+        const job_result_t *result = &results[(result_seq - i) % JOB_RESULTS_KEPT];
+        if (result->job_id == job_id) {
+            return result;
+        }
+    }
+    return NULL;
+}
+
+// The seq-th completion, NULL if it has not happened or is no longer kept
+const job_result_t *job_result(unsigned long seq) {
+    const job_result_t *result = &results[seq % JOB_RESULTS_KEPT];
+    return seq > 0 && result->seq == seq ? result : NULL;
+}
+
+// seq of the latest completion, 0 before the first
+unsigned long last_result_seq(void) {
+    return result_seq;
+}
+
+// Are any jobs running or queued, i.e. bound to finish without help?
+int jobs_pending(void) {
+    return running_jobs > 0 || running_tasks > 0 || queue_head != NULL;
+}
+
+// A finished job as a whole is judged by its last stage: normal means exit 0
+static int ended_normally(const bg_job_t *job) {
+    int status = job->procs[job->nprocs - 1].wait_status;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// The job's last member is gone: report it, or hand it to the built-in that
+// started it, and drop it. Returns 1 if anything was printed
+static int complete_job(bg_job_t *job, int normally) {
+    int printed = 1;
+    record_result(job);
+    if (job->on_exit) {
+        printed = job->on_exit(job, job->exit_arg);
+    } else {
+        report_completion(job, normally);
+    }
+    drop_job(job);
+    return printed;
+}
+
 // Initialize background job tracking system
 void init_bg_jobs(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        bg_jobs[i].active = 0;
-        bg_jobs[i].job_id = 0;
-        bg_jobs[i].pid = 0;
-        bg_jobs[i].pgid = 0;
-        bg_jobs[i].status = JOB_RUNNING;
-        memset(bg_jobs[i].command, 0, MAX_CMD_LEN);
+    while (jobs_head) {
+        drop_job(jobs_head);
     }
     next_job_id = 1;
     job_count = 0;
+    proc_count = 0;
+    running_jobs = 0;
+    running_tasks = 0;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    max_jobs = cpus > 0 ? (int)cpus : 1;
     foreground_pid = 0;
     foreground_pgid = 0;
 }
 
-// Check for completed background processes (non-blocking)
-void check_background_processes(void) {
-    pid_t pid;
-    int status;
-    
-    // Check all background processes without blocking
-    while ((pid = waitpid(-1, &status, WNOHANG | WUNTRACED | WCONTINUED)) > 0) {
-        // Find the job with this PID
-        for (int i = 0; i < MAX_JOBS; i++) {
-            if (bg_jobs[i].active && bg_jobs[i].pid == pid) {
-                if (WIFSTOPPED(status)) {
-                    // Process was stopped (Ctrl-Z)
-                    bg_jobs[i].status = JOB_STOPPED;
-                    printf("[%d] Stopped %s\n", bg_jobs[i].job_id, bg_jobs[i].command);
-                    fflush(stdout);
-                } else if (WIFCONTINUED(status)) {
-                    bg_jobs[i].status = JOB_RUNNING;
-                    printf("[%d] Continued %s\n", bg_jobs[i].job_id, bg_jobs[i].command);
-                    fflush(stdout);
-                } else {
-                    // Process completed - print completion message to stdout
-                    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-                        printf("%s with pid %d exited normally\n", 
-                               bg_jobs[i].command, pid);
-                    } else {
-                        printf("%s with pid %d exited abnormally\n", 
-                               bg_jobs[i].command, pid);
-                    }
-                    fflush(stdout);
-                    
-                    // Remove from job list
-                    bg_jobs[i].active = 0;
-                    bg_jobs[i].job_id = 0;
-                    bg_jobs[i].pid = 0;
-                    bg_jobs[i].pgid = 0;
-                    bg_jobs[i].status = JOB_DONE;
-                    memset(bg_jobs[i].command, 0, MAX_CMD_LEN);
-                    job_count--;
-                }
-                break;
-            }
+// Record a state change of a job member, as reaped by the event loop. The
+// job stops when a member stops and completes when its last member exits.
+// Notices go to the shell's own stdout. Returns 1 if one was printed, 0 otherwise
+int job_child_status(pid_t pid, int status, const struct rusage *usage) {
+    job_proc_t *proc = find_job_proc(pid);
+    if (!proc) {
+        return 0;
+    }
+    bg_job_t *job = proc->job;
+    int printed = 0;
+    int redirected = enter_shell_stdout();
+
+    if (WIFSTOPPED(status)) {
+        // Process was stopped (Ctrl-Z)
+        proc->status = JOB_STOPPED;
+        if (job->status != JOB_STOPPED) {
+            set_job_status(job, JOB_STOPPED);
+            printf("[%d] Stopped %s\n", job->job_id, job->command);
+            fflush(stdout);
+            printed = 1;
+        }
+    } else if (WIFCONTINUED(status)) {
+        proc->status = JOB_RUNNING;
+        if (job->status != JOB_RUNNING) {
+            set_job_status(job, JOB_RUNNING);
+            printf("[%d] Continued %s\n", job->job_id, job->command);
+            fflush(stdout);
+            printed = 1;
+        }
+    } else {
+        retire_proc(proc, status, usage);
+        if (job->nlive == 0) {
+            printed = complete_job(job, ended_normally(job));
         }
     }
+    // A stopped or finished job frees its slot
+    admit_queued_jobs();
+    leave_shell_stdout(redirected);
+    return printed;
 }
 
 // Add a new background job to tracking
@@ -85,44 +632,49 @@ int add_background_job(pid_t pid, const char* command) {
     if (!command || pid <= 0) {
         return -1;
     }
-    
-    // Find an empty slot
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (!bg_jobs[i].active) {
-            bg_jobs[i].job_id = next_job_id++;
-            bg_jobs[i].pid = pid;
-            bg_jobs[i].pgid = pid; // Usually the same as pid for background jobs
-            bg_jobs[i].status = JOB_RUNNING;
-            
-            // Store just the command name, not full path with args
-            strncpy(bg_jobs[i].command, command, MAX_CMD_LEN - 1);
-            bg_jobs[i].command[MAX_CMD_LEN - 1] = '\0';
-            
-            bg_jobs[i].active = 1;
-            job_count++;
-            
-            // Print job information to stderr as required
-            fprintf(stderr, "[%d] %d\n", bg_jobs[i].job_id, pid);
-            fflush(stderr);
-            
-            return bg_jobs[i].job_id;
-        }
+
+    return add_job_members(pid, &pid, &command, NULL, NULL, 1, JOB_RUNNING, NULL);
+}
+
+// Add a job made of the processes of a pipeline (pids[i] ran names[i]; pids
+// <= 0 are skipped). statuses (optional) holds the wait status of members that
+// already exited, -1 for the others, and usages their resource usage.
+// started (NULL for now) is when the pipeline was launched
+int add_job_members(pid_t pgid, const pid_t *pids, const char *const *names,
+                    const int *statuses, const struct rusage *usages, int n,
+                    job_status_t status, const struct timespec *started) {
+    bg_job_t *job = add_job(pgid, pids, names, statuses, usages, n, status, started, NULL, NULL);
+    if (!job) {
+        perror("add_background_job");
+        return -1;
     }
-    
-    return -1; // No space for new job
+
+    if (status == JOB_RUNNING) {
+        // Print job information to stderr as required
+        fprintf(stderr, "[%d] %d\n", job->job_id, job->pid);
+        fflush(stderr);
+    }
+
+    return job->job_id;
+}
+
+// Register a process a built-in started on its own behalf (see parallel.c).
+// It is a job like any other (activities, fg and ping see it) but starts
+// quietly, does not take one of maxjobs's slots (the built-in limits its own
+// processes) and on_exit gets its completion instead of the usual report
+int add_task_job(pid_t pid, const char *command, job_exit_fn on_exit, void *arg) {
+    bg_job_t *job = add_job(pid, &pid, &command, NULL, NULL, 1, JOB_RUNNING, NULL, on_exit, arg);
+    if (!job) {
+        return -1;
+    }
+    return job->job_id;
 }
 
 // Remove a background job (called when job completes)
 void remove_background_job(pid_t pid) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (bg_jobs[i].active && bg_jobs[i].pid == pid) {
-            bg_jobs[i].active = 0;
-            bg_jobs[i].job_id = 0;
-            bg_jobs[i].pid = 0;
-            memset(bg_jobs[i].command, 0, MAX_CMD_LEN);
-            job_count--;
-            break;
-        }
+    bg_job_t *job = find_job_by_pid(pid);
+    if (job) {
+        drop_job(job);
     }
 }
 
@@ -259,140 +811,177 @@ int get_active_job_count(void) {
     return job_count;
 }
 
-// Get job information by index (for activities command)
-void get_job_info(int index, pid_t *pid, char *command, int *status) {
-    if (index < 0 || index >= MAX_JOBS || !pid || !command || !status) {
-        if (pid) *pid = 0;
-        if (command) command[0] = '\0';
-        if (status) *status = JOB_DONE;
-        return;
-    }
-    
-    if (bg_jobs[index].active) {
-        *pid = bg_jobs[index].pid;
-        strncpy(command, bg_jobs[index].command, MAX_CMD_LEN - 1);
-        command[MAX_CMD_LEN - 1] = '\0';
-        *status = bg_jobs[index].status;
-    } else {
-        *pid = 0;
-        command[0] = '\0';
-        *status = JOB_DONE;
-    }
+// Oldest job; follow ->next for the rest in job-id order
+bg_job_t *first_job(void) {
+    return jobs_head;
 }
 
 // Find job by job number (1-based)
-int find_job_by_number(int job_number) {
-    if (job_number <= 0) return -1;
-    
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (bg_jobs[i].active && bg_jobs[i].job_id == job_number) {
-            return i;
+bg_job_t *find_job_by_number(int job_number) {
+    if (job_number <= 0 || !bucket_count) return NULL;
+
+    for (bg_job_t *job = id_buckets[bucket_of((unsigned)job_number)]; job; job = job->id_next) {
+        if (job->job_id == job_number) {
+            return job;
         }
     }
-    return -1;
+    return NULL;
 }
 
-// Get the most recent background/stopped job
-int get_most_recent_job(void) {
-    int most_recent = -1;
-    int highest_id = -1;
-    
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (bg_jobs[i].active && bg_jobs[i].job_id > highest_id) {
-            highest_id = bg_jobs[i].job_id;
-            most_recent = i;
+// Find the live job member whose process is pid
+job_proc_t *find_job_proc(pid_t pid) {
+    if (pid <= 0 || !bucket_count) return NULL;
+
+    for (job_proc_t *proc = pid_buckets[bucket_of((unsigned)pid)]; proc; proc = proc->pid_next) {
+        if (proc->pid == pid) {
+            return proc;
         }
     }
-    
-    return most_recent;
+    return NULL;
 }
 
-// Get job number (ID) for a given job index
-int get_job_number(int job_index) {
-    if (job_index < 0 || job_index >= MAX_JOBS || !bg_jobs[job_index].active) {
-        return -1;
-    }
-    return bg_jobs[job_index].job_id;
+// Find the job one of whose live processes is pid
+bg_job_t *find_job_by_pid(pid_t pid) {
+    job_proc_t *proc = find_job_proc(pid);
+    return proc ? proc->job : NULL;
 }
 
-// Resume a stopped job (send SIGCONT)
-void resume_job(int job_index) {
-    if (job_index < 0 || job_index >= MAX_JOBS || !bg_jobs[job_index].active) {
-        return;
-    }
-    
-    if (bg_jobs[job_index].status == JOB_STOPPED) {
-        if (kill(bg_jobs[job_index].pid, SIGCONT) == 0) {
-            bg_jobs[job_index].status = JOB_RUNNING;
+// Get the most recent background/stopped job
+bg_job_t *get_most_recent_job(void) {
+    return jobs_tail;
+}
+
+// Resume a stopped job (send SIGCONT), or start a queued one without waiting
+// for a slot. A queued job that cannot be started is dropped
+void resume_job(bg_job_t *job) {
+    if (job->status == JOB_QUEUED) {
+        start_queued_job(job);
+    } else if (job->status == JOB_STOPPED) {
+        // The whole group: every stage of a stopped pipeline needs to continue
+        if (signal_group(job_pidfd(job), job->pgid, SIGCONT) == 0) {
+            set_job_status(job, JOB_RUNNING);
+            for (int i = 0; i < job->nprocs; i++) {
+                if (job->procs[i].status == JOB_STOPPED) {
+                    job->procs[i].status = JOB_RUNNING;
+                }
+            }
         }
     }
 }
 
 // Bring a job to foreground
-void bring_job_to_foreground(int job_index) {
-    if (job_index < 0 || job_index >= MAX_JOBS || !bg_jobs[job_index].active) {
+void bring_job_to_foreground(bg_job_t *job) {
+    // A queued job skips the queue and runs like a command typed at the
+    // prompt (the terminal's stdin and process group); Ctrl-Z makes it a new
+    // stopped job
+    if (job->status == JOB_QUEUED) {
+        job_launch_fn launch = job->launch;
+        void *arg = job->launch_arg;
+        dequeue_job(job);
+        job->status = JOB_DONE; // arg now belongs to the launch below
+        drop_job(job);
+        launch(arg, JOB_LAUNCH_FOREGROUND);
+        admit_queued_jobs();
         return;
     }
 
     // Save the shell's current controlling terminal foreground pgid
     pid_t shell_tty_pgid = tcgetpgrp(STDIN_FILENO);
 
+    // The members still alive are waited for as one foreground pipeline
+    job_proc_t **live = malloc((size_t)job->nlive * sizeof(job_proc_t *));
+    pid_t *pids = malloc((size_t)job->nlive * sizeof(pid_t));
+    int *statuses = malloc((size_t)job->nlive * sizeof(int));
+    struct rusage *usages = malloc((size_t)job->nlive * sizeof(struct rusage));
+    if (!live || !pids || !statuses || !usages) {
+        perror("malloc");
+        free(live);
+        free(pids);
+        free(statuses);
+        free(usages);
+        return;
+    }
+    int nlive = 0;
+    for (int i = 0; i < job->nprocs; i++) {
+        if (job->procs[i].status != JOB_DONE) {
+            live[nlive] = &job->procs[i];
+            pids[nlive++] = job->procs[i].pid;
+        }
+    }
+
     // Give terminal control to the job's process group
-    setpgid(bg_jobs[job_index].pid, bg_jobs[job_index].pid);
-    tcsetpgrp(STDIN_FILENO, bg_jobs[job_index].pid);
+    setpgid(job->pid, job->pgid);
+    tcsetpgrp(STDIN_FILENO, job->pgid);
 
     // Track the foreground job for signal forwarding
-    set_foreground_process(bg_jobs[job_index].pid, bg_jobs[job_index].pid);
+    set_foreground_process(job->pid, job->pgid);
 
     // Resume if stopped
-    if (bg_jobs[job_index].status == JOB_STOPPED) {
-        resume_job(job_index);
-    }
-
-    // Wait until the job completes or stops again
-    int status;
-    pid_t result = waitpid(bg_jobs[job_index].pid, &status, WUNTRACED);
-
-    if (result > 0) {
-        if (WIFEXITED(status)) {
-            printf("%s with pid %d exited normally\n",
-                   bg_jobs[job_index].command, bg_jobs[job_index].pid);
-            remove_background_job(bg_jobs[job_index].pid);
-        } else if (WIFSIGNALED(status)) {
-            printf("%s with pid %d exited abnormally\n",
-                   bg_jobs[job_index].command, bg_jobs[job_index].pid);
-            remove_background_job(bg_jobs[job_index].pid);
-        } else if (WIFSTOPPED(status)) {
-            // Job was stopped again - mark as stopped and leave in job list
-            bg_jobs[job_index].status = JOB_STOPPED;
-            printf("[%d] Stopped %s\n", bg_jobs[job_index].job_id, bg_jobs[job_index].command);
+    if (job->status == JOB_STOPPED) {
+        resume_job(job);
+    }
+
+    // Wait until the job completes or stops again (the job record stays put meanwhile)
+    int stopped = loop_wait_foreground(pids, nlive, statuses, usages);
+    for (int i = 0; i < nlive; i++) {
+        if (statuses[i] != -1) {
+            retire_proc(live[i], statuses[i], &usages[i]);
+        }
+    }
+
+    if (stopped) {
+        // Job was stopped again - mark as stopped and leave in job list
+        set_job_status(job, JOB_STOPPED);
+        for (int i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].status == JOB_RUNNING) {
+                job->procs[i].status = JOB_STOPPED;
+            }
         }
+        printf("[%d] Stopped %s\n", job->job_id, job->command);
+    } else if (job->nlive == 0) {
+        complete_job(job, ended_normally(job));
     }
+    free(live);
+    free(pids);
+    free(statuses);
+    free(usages);
 
     // Clear foreground tracking and restore terminal control
     clear_foreground_process();
     tcsetpgrp(STDIN_FILENO, shell_tty_pgid);
     fflush(stdout);
+    admit_queued_jobs();
 }
 
 // Clean up all background jobs (for shell exit - Ctrl-D requirement)
 void cleanup_all_jobs(void) {
     // Send SIGKILL to all active background processes (Ctrl-D requirement)
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (bg_jobs[i].active) {
-            // Send SIGKILL to the entire process group
-            kill(-bg_jobs[i].pgid, SIGKILL);
+    for (bg_job_t *job = jobs_head; job; job = job->next) {
+        if (job->status == JOB_QUEUED) {
+            continue; // never started, dropped below
         }
+        // Send SIGKILL to the entire process group
+        signal_group(job_pidfd(job), job->pgid, SIGKILL);
     }
-    
+    // Reap them before the jobs are dropped: a cgroup whose members have not
+    // been waited for cannot be removed yet (EBUSY)
+    for (bg_job_t *job = jobs_head; job; job = job->next) {
+        for (int i = 0; i < job->nprocs; i++) {
+            if (job->procs[i].status == JOB_DONE) continue;
+            while (waitpid(job->procs[i].pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+        }
+    }
+
     // Reset the job tracking
     init_bg_jobs();
+    cgroup_shutdown(); // leave the leaf cgroup limit may have moved the shell into
 }
 
-// Signal handler for SIGINT (Ctrl-C)
+// SIGINT (Ctrl-C), read from the event loop's signalfd
 void sigint_handler(int sig) {
     (void)sig; // Suppress unused parameter warning
-    
+
     if (foreground_pgid > 0) {
         // Send SIGINT to the foreground process group
         kill(-foreground_pgid, SIGINT);
@@ -401,10 +990,10 @@ void sigint_handler(int sig) {
     write(STDOUT_FILENO, "\n", 1);
 }
 
-// Signal handler for SIGTSTP (Ctrl-Z)
+// SIGTSTP (Ctrl-Z), read from the event loop's signalfd
 void sigtstp_handler(int sig) {
     (void)sig; // Suppress unused parameter warning
-    
+
     if (foreground_pgid > 0) {
         // Send SIGTSTP to the foreground process group
         kill(-foreground_pgid, SIGTSTP);
@@ -413,26 +1002,6 @@ void sigtstp_handler(int sig) {
     write(STDOUT_FILENO, "\n", 1);
 }
 
-// Setup signal handling for the shell
-void setup_signal_handling(void) {
-    struct sigaction sa_int, sa_tstp;
-    
-    // Setup SIGINT handler (Ctrl-C)
-    sa_int.sa_handler = sigint_handler;
-    sigemptyset(&sa_int.sa_mask);
-    sa_int.sa_flags = SA_RESTART;
-    sigaction(SIGINT, &sa_int, NULL);
-    
-    // Setup SIGTSTP handler (Ctrl-Z)
-    sa_tstp.sa_handler = sigtstp_handler;
-    sigemptyset(&sa_tstp.sa_mask);
-    sa_tstp.sa_flags = SA_RESTART;
-    sigaction(SIGTSTP, &sa_tstp, NULL);
-    
-    // Ignore SIGCHLD to prevent default behavior but handle with waitpid
-    signal(SIGCHLD, SIG_DFL);
-}
-
 // Set the current foreground process
 void set_foreground_process(pid_t pid, pid_t pgid) {
     foreground_pid = pid;
@@ -450,24 +1019,6 @@ int add_stopped_job(pid_t pid, const char* command) {
     if (!command || pid <= 0) {
         return -1;
     }
-    
-    // Find an empty slot
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (!bg_jobs[i].active) {
-            bg_jobs[i].job_id = next_job_id++;
-            bg_jobs[i].pid = pid;
-            bg_jobs[i].pgid = pid;
-            bg_jobs[i].status = JOB_STOPPED;
-            
-            strncpy(bg_jobs[i].command, command, MAX_CMD_LEN - 1);
-            bg_jobs[i].command[MAX_CMD_LEN - 1] = '\0';
-            
-            bg_jobs[i].active = 1;
-            job_count++;
-            
-            return bg_jobs[i].job_id;
-        }
-    }
-    
-    return -1;
-}
\ No newline at end of file
+
+    return add_job_members(pid, &pid, &command, NULL, NULL, 1, JOB_STOPPED, NULL);
+}
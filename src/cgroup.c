@@ -0,0 +1,323 @@
+#include "shell.h"
+#include "cgroup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Job cgroups live under the shell's own cgroup v2 directory, which must have
+// the memory and cpu controllers enabled for its children. If it still holds
+// processes (the shell) the kernel refuses that ("no internal processes"), so
+// the shell first moves itself into the leaf <base>/shells, shared by every
+// shell started in that cgroup. The last one to exit moves back, disables the
+// controllers again and removes the leaf (cgroup_shutdown). Anything that
+// fails here only means limits are applied per process instead.
+
+#define CGROUP_PATH_MAX 4096
+#define CPU_PERIOD_USEC 100000
+#define SHELL_LEAF "shells"
+
+struct job_cgroup {
+    int dirfd;                      // for clone3(CLONE_INTO_CGROUP)
+    char path[];
+};
+
+static int probed = 0;
+static char base_path[CGROUP_PATH_MAX];  // "" when job cgroups are unavailable
+static unsigned job_seq = 0;
+static int in_leaf = 0;                  // the shell moved itself into SHELL_LEAF
+
+static const char limit_usage[] = "Usage: limit [--cpu N%] [--mem SIZE[K|M|G]] cmd [args...]\n";
+
+// Mount point of the cgroup v2 hierarchy, from /proc/self/mountinfo
+static int find_cgroup2_mount(char *buf, size_t size) {
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) return -1;
+
+    char line[CGROUP_PATH_MAX];
+    int found = -1;
+    while (found == -1 && fgets(line, sizeof(line), f)) {
+        // id parent major:minor root mount-point options [optional...] - fstype ...
+        char *sep = strstr(line, " - ");
+        if (!sep || strncmp(sep + 3, "cgroup2 ", 8) != 0) continue;
+        char *field = line;
+        for (int i = 0; i < 4 && field; i++) {
+            field = strchr(field, ' ');
+            if (field) field++;
+        }
+        char *end = field ? strchr(field, ' ') : NULL;
+        if (end && (size_t)(end - field) < size) {
+            memcpy(buf, field, (size_t)(end - field));
+            buf[end - field] = '\0';
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// The shell's cgroup v2 path ("0::/path" in /proc/self/cgroup)
+static int own_cgroup(char *buf, size_t size) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+
+    char line[CGROUP_PATH_MAX];
+    int found = -1;
+    while (found == -1 && fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) != 0) continue;
+        line[strcspn(line, "\n")] = '\0';
+        if (strlen(line + 3) < size) {
+            strcpy(buf, line + 3);
+            found = 0;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[CGROUP_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n == (ssize_t)strlen(value) ? 0 : -1;
+}
+
+static int read_file(const char *dir, const char *name, char *buf, size_t size) {
+    char path[CGROUP_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return -1;
+    ssize_t n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0) return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+// Does the space separated list in file name contain word?
+static int file_has_word(const char *dir, const char *name, const char *word) {
+    char buf[512];
+    if (read_file(dir, name, buf, sizeof(buf)) == -1) return 0;
+    for (char *tok = strtok(buf, " \n"); tok; tok = strtok(NULL, " \n")) {
+        if (strcmp(tok, word) == 0) return 1;
+    }
+    return 0;
+}
+
+static int children_controlled(const char *dir) {
+    return file_has_word(dir, "cgroup.subtree_control", "memory") &&
+           file_has_word(dir, "cgroup.subtree_control", "cpu");
+}
+
+// Find (once) the directory job cgroups are created in
+static void probe_base(void) {
+    char mount[CGROUP_PATH_MAX], self[CGROUP_PATH_MAX];
+    probed = 1;
+    base_path[0] = '\0';
+    if (find_cgroup2_mount(mount, sizeof(mount)) == -1 || own_cgroup(self, sizeof(self)) == -1) {
+        return;
+    }
+    if (snprintf(base_path, sizeof(base_path), "%s%s", mount,
+                 strcmp(self, "/") == 0 ? "" : self) >= (int)sizeof(base_path)) {
+        base_path[0] = '\0';
+        return;
+    }
+    if (!file_has_word(base_path, "cgroup.controllers", "memory") ||
+        !file_has_word(base_path, "cgroup.controllers", "cpu")) {
+        base_path[0] = '\0'; // not delegated to us, or controllers bound to cgroup v1
+        return;
+    }
+    if (children_controlled(base_path) ||
+        write_file(base_path, "cgroup.subtree_control", "+memory +cpu") == 0) {
+        return;
+    }
+    if (errno == EBUSY) {
+        // Processes may only live in leaves: move the shell into one and retry
+        char leaf[CGROUP_PATH_MAX];
+        if (snprintf(leaf, sizeof(leaf), "%s/" SHELL_LEAF, base_path) >= (int)sizeof(leaf)) {
+            base_path[0] = '\0';
+            return;
+        }
+        if ((mkdir(leaf, 0755) == 0 || errno == EEXIST) &&
+            write_file(leaf, "cgroup.procs", "0") == 0) {
+            if (write_file(base_path, "cgroup.subtree_control", "+memory +cpu") == 0) {
+                in_leaf = 1;
+                return;
+            }
+            write_file(base_path, "cgroup.procs", "0");
+        }
+        rmdir(leaf); // fails harmlessly while other shells are in it
+    }
+    base_path[0] = '\0';
+}
+
+// A fresh cgroup with the job's limits, or NULL to fall back to rlimits
+job_cgroup_t *cgroup_create(const job_limits_t *limits) {
+    if (!probed) {
+        probe_base();
+    }
+    if (!base_path[0]) {
+        return NULL;
+    }
+
+    char path[CGROUP_PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/job-%d-%u", base_path, (int)getpid(), ++job_seq) >=
+        (int)sizeof(path)) {
+        return NULL;
+    }
+    job_cgroup_t *cgroup = malloc(sizeof(job_cgroup_t) + strlen(path) + 1);
+    if (!cgroup) {
+        return NULL;
+    }
+    strcpy(cgroup->path, path);
+    if (mkdir(path, 0755) == -1) {
+        free(cgroup);
+        return NULL;
+    }
+
+    char value[64];
+    int ok = 1;
+    if (limits->cpu_percent > 0) {
+        snprintf(value, sizeof(value), "%ld %d",
+                 (long)limits->cpu_percent * CPU_PERIOD_USEC / 100, CPU_PERIOD_USEC);
+        ok = write_file(path, "cpu.max", value) == 0;
+    }
+    if (ok && limits->mem_bytes > 0) {
+        snprintf(value, sizeof(value), "%llu", limits->mem_bytes);
+        ok = write_file(path, "memory.max", value) == 0;
+    }
+    cgroup->dirfd = ok ? open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC) : -1;
+    if (cgroup->dirfd == -1) {
+        rmdir(path);
+        free(cgroup);
+        return NULL;
+    }
+    return cgroup;
+}
+
+int cgroup_fd(const job_cgroup_t *cgroup) {
+    return cgroup->dirfd;
+}
+
+// Current memory use (bytes) and CPU time used so far (usec) of a job's cgroup
+int cgroup_stats(const job_cgroup_t *cgroup, unsigned long long *mem_current,
+                 unsigned long long *cpu_usec) {
+    char buf[1024];
+    if (read_file(cgroup->path, "memory.current", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    *mem_current = strtoull(buf, NULL, 10);
+    if (read_file(cgroup->path, "cpu.stat", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char *usage = strstr(buf, "usage_usec ");
+    *cpu_usec = usage ? strtoull(usage + 11, NULL, 10) : 0;
+    return 0;
+}
+
+// The job is over: remove its cgroup (left alone if something still runs in it)
+void cgroup_release(job_cgroup_t *cgroup) {
+    if (!cgroup) {
+        return;
+    }
+    close(cgroup->dirfd);
+    rmdir(cgroup->path);
+    free(cgroup);
+}
+
+// The shell is exiting: if it is the last one in SHELL_LEAF, move back to the
+// base cgroup (after turning the controllers off again, which the kernel
+// requires first) and remove the leaf. Otherwise the others still need both
+void cgroup_shutdown(void) {
+    if (!in_leaf) {
+        return;
+    }
+    in_leaf = 0;
+    char leaf[CGROUP_PATH_MAX], procs[64];
+    if (snprintf(leaf, sizeof(leaf), "%s/" SHELL_LEAF, base_path) >= (int)sizeof(leaf) ||
+        read_file(leaf, "cgroup.procs", procs, sizeof(procs)) == -1 ||
+        strtol(procs, NULL, 10) != (long)getpid() || strchr(procs, '\n') != strrchr(procs, '\n')) {
+        return;
+    }
+    if (write_file(base_path, "cgroup.subtree_control", "-memory -cpu") == 0 &&
+        write_file(base_path, "cgroup.procs", "0") == 0) {
+        rmdir(leaf);
+    }
+}
+
+// 512M, 2G, 4096 ... in bytes; 0 on a malformed or unrepresentable size
+static unsigned long long parse_size(const char *s) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (end == s || *s == '-' || errno == ERANGE) return 0;
+    int shift = 0;
+    switch (*end) {
+    case 'K': case 'k': shift = 10; end++; break;
+    case 'M': case 'm': shift = 20; end++; break;
+    case 'G': case 'g': shift = 30; end++; break;
+    default: break;
+    }
+    if (*end != '\0' || n > (ULLONG_MAX >> shift)) return 0;
+    return n << shift;
+}
+
+// Parse "limit [--cpu N%] [--mem SIZE] cmd ...". Returns the index of cmd in
+// argv, or -1 (after printing why) on a malformed prefix
+int parse_limits(int argc, char **argv, job_limits_t *limits) {
+    limits->cpu_percent = 0;
+    limits->mem_bytes = 0;
+    limits->cgroup = NULL;
+
+    int i = 1;
+    for (; i < argc && strncmp(argv[i], "--", 2) == 0; i += 2) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s", limit_usage);
+            return -1;
+        }
+        if (strcmp(argv[i], "--cpu") == 0) {
+            char *end;
+            long pct = strtol(argv[i + 1], &end, 10);
+            if (end == argv[i + 1] || (*end != '\0' && strcmp(end, "%") != 0) ||
+                pct < 1 || pct > 100000) {
+                fprintf(stderr, "limit: invalid CPU share: %s\n", argv[i + 1]);
+                return -1;
+            }
+            limits->cpu_percent = (int)pct;
+        } else if (strcmp(argv[i], "--mem") == 0) {
+            limits->mem_bytes = parse_size(argv[i + 1]);
+            if (limits->mem_bytes == 0) {
+                fprintf(stderr, "limit: invalid memory size: %s\n", argv[i + 1]);
+                return -1;
+            }
+        } else {
+            fprintf(stderr, "%s", limit_usage);
+            return -1;
+        }
+    }
+    if (i >= argc) {
+        fprintf(stderr, "%s", limit_usage);
+        return -1;
+    }
+    return i;
+}
+
+// limit is a prefix the executor applies to a whole cmd_group; reaching the
+// built-in itself means it was used anywhere else
+void limit_command(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "limit: must start a command (limit [options] cmd | ...)\n");
+}
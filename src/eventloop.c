@@ -0,0 +1,585 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include "bg_jobs.h"
+#include "eventloop.h"
+#include "launch.h"
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <signal.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+// SIGCHLD, SIGINT and SIGTSTP stay blocked in the shell and are read from a
+// signalfd, so nothing runs asynchronously: every child state change is
+// reaped by the loop the moment it is reported.
+//
+// Every child the shell tracks (job or foreground stage) is watched through a
+// pidfd: its exit makes exactly that pidfd readable and only that pid is
+// reaped. SIGCHLD is then only needed for stops and continues. Without
+// pidfds (old kernel, or one could not be opened) SIGCHLD reaps everything.
+// Children are reaped with wait4(), so their resource usage is kept too.
+//
+// Timers (job deadlines) live in a binary min-heap on their deadline, and the
+// single timerfd is always armed for the earliest one: any number of pending
+// timers costs one fd, O(log n) to add or cancel and no work until one is due.
+
+// epoll data: one of these, (pidfd << 32 | pid) for a watched child, or
+// SRC_FD | fd for an fd watched with loop_watch_fd()
+enum { SRC_STDIN, SRC_SIGNAL, SRC_TIMER };
+#define SRC_FD (1ULL << 63)
+
+static int epoll_fd = -1;
+static int signal_fd = -1;
+static int timer_fd = -1;
+static int stdin_polled = 0;     // regular files cannot be polled, but never block either
+static pid_t loop_owner = 0;     // forked children fall back to plain blocking calls
+static int legacy_reap = 0;      // some child has no pidfd: reap with waitpid(-1)
+
+struct loop_timer {
+    uint64_t deadline;           // CLOCK_MONOTONIC, ns
+    loop_timer_fn fn;
+    void *arg;
+    int index;                   // position in the heap
+};
+
+static loop_timer_t **timers = NULL; // min-heap on deadline
+static int ntimers = 0;
+static int timer_cap = 0;
+
+// loop_watch_fd() callbacks, indexed by fd
+typedef struct {
+    loop_fd_fn fn;
+    void *arg;
+} fd_watcher_t;
+
+static fd_watcher_t *fd_watchers = NULL;
+static int fd_watcher_cap = 0;
+static int interrupted = 0;      // Ctrl-C while nothing ran in the foreground
+
+// The foreground job being waited for, if any
+typedef struct {
+    const pid_t *pids;
+    int *pidfds;                 // -1 once that stage is reaped
+    int npids;
+    int remaining;
+    int stopped;
+    int *statuses;               // caller's: wait status per pid, -1 until it exits
+    struct rusage *usages;       // caller's: resource usage per exited pid
+} fg_wait_t;
+
+static fg_wait_t fg_wait;
+
+static int watch(int fd, uint64_t data) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = data;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+// Stop (or resume) reporting stdin, so typed-ahead input does not spin a foreground wait
+static void mute_stdin(int mute) {
+    if (!stdin_polled) return;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = mute ? 0 : EPOLLIN;
+    ev.data.u64 = SRC_STDIN;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, STDIN_FILENO, &ev);
+}
+
+int loop_init(void) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTSTP);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("sigprocmask");
+        return -1;
+    }
+
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd == -1 || timer_fd == -1 || epoll_fd == -1) {
+        perror("loop_init");
+        return -1;
+    }
+    if (watch(signal_fd, SRC_SIGNAL) == -1 || watch(timer_fd, SRC_TIMER) == -1) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    if (watch(STDIN_FILENO, SRC_STDIN) == 0) {
+        stdin_polled = 1;
+    } else if (errno != EPERM) {
+        perror("epoll_ctl");
+        return -1;
+    }
+
+    // Probe once; the shell's own pid always exists
+    int probe = open_pidfd(getpid());
+    if (probe == -1) {
+        legacy_reap = 1;
+    } else {
+        close(probe);
+    }
+
+    loop_owner = getpid();
+    return 0;
+}
+
+// False in a forked child of the shell (a background or piped built-in),
+// where nothing is reaped by the loop
+int loop_is_owner(void) {
+    return loop_owner != 0 && getpid() == loop_owner;
+}
+
+// Watch a child through a pidfd; its exit is reported as soon as it happens.
+// Returns the pidfd (the caller owns it; closing it ends the watch) or -1
+int loop_watch_pid(pid_t pid) {
+    if (getpid() != loop_owner || legacy_reap) {
+        return -1;
+    }
+    int pidfd = open_pidfd(pid);
+    if (pidfd != -1 && watch(pidfd, ((uint64_t)(uint32_t)pidfd << 32) | (uint32_t)pid) == -1) {
+        close(pidfd);
+        pidfd = -1;
+    }
+    if (pidfd == -1) {
+        legacy_reap = 1; // this child can only be found by waitpid(-1) now
+    }
+    return pidfd;
+}
+
+// Hand one reaped wait status (and its usage) to whoever tracks pid: the
+// foreground wait or the job table. Returns the number of job notifications printed
+static int reap_pid(pid_t pid, int status, const struct rusage *usage) {
+    for (int i = 0; i < fg_wait.npids; i++) {
+        if (fg_wait.pids[i] != pid) {
+            continue;
+        }
+        if (WIFSTOPPED(status)) {
+            fg_wait.stopped = 1;
+        } else if (!WIFCONTINUED(status)) {
+            fg_wait.remaining--;
+            if (fg_wait.pidfds[i] != -1) {
+                close(fg_wait.pidfds[i]);
+                fg_wait.pidfds[i] = -1;
+            }
+            if (fg_wait.statuses) {
+                fg_wait.statuses[i] = status;
+            }
+            if (fg_wait.usages) {
+                fg_wait.usages[i] = *usage;
+            }
+        }
+        return 0;
+    }
+    return job_child_status(pid, status, usage);
+}
+
+// SIGCHLD: collect stops and continues (and, in legacy mode, exits)
+static int reap_children(void) {
+    int printed = 0;
+    int status;
+    struct rusage usage;
+    pid_t pid;
+
+    if (legacy_reap) {
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            printed += reap_pid(pid, status, &usage);
+        }
+        return printed;
+    }
+
+    // Exits are left to the pidfds: peek at pending stop/continue events only
+    while (1) {
+        siginfo_t si;
+        memset(&si, 0, sizeof(si));
+        if (waitid(P_ALL, 0, &si, WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT) == -1 || si.si_pid == 0) {
+            break;
+        }
+        if (wait4(si.si_pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage) <= 0) {
+            break;
+        }
+        printed += reap_pid(si.si_pid, status, &usage);
+    }
+    return printed;
+}
+
+// A watched child's pidfd became readable: it has exited
+static int handle_pid_exit(uint64_t data) {
+    pid_t pid = (pid_t)(uint32_t)data;
+    int pidfd = (int)(data >> 32);
+    int status;
+    struct rusage usage;
+
+    pid_t result = wait4(pid, &status, WNOHANG, &usage);
+    if (result > 0) {
+        return reap_pid(pid, status, &usage);
+    }
+    if (result == -1) {
+        // Reaped elsewhere (another pidfd on the same child): stop watching
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, pidfd, NULL);
+    }
+    return 0;
+}
+
+// Returns the number of lines written to the terminal
+static int handle_signals(void) {
+    struct signalfd_siginfo si;
+    int printed = 0;
+    int child = 0;
+
+    while (read(signal_fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGCHLD:
+            child = 1; // several exits may share one SIGCHLD, reap them all below
+            break;
+        case SIGINT:
+            interrupted |= foreground_pgid <= 0;
+            sigint_handler(SIGINT);
+            printed++;
+            break;
+        case SIGTSTP:
+            sigtstp_handler(SIGTSTP);
+            printed++;
+            break;
+        }
+    }
+    if (child) {
+        printed += reap_children();
+    }
+    return printed;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void heap_place(loop_timer_t *timer, int index) {
+    timers[index] = timer;
+    timer->index = index;
+}
+
+static void sift_up(int i) {
+    loop_timer_t *timer = timers[i];
+    while (i > 0 && timers[(i - 1) / 2]->deadline > timer->deadline) {
+        heap_place(timers[(i - 1) / 2], i);
+        i = (i - 1) / 2;
+    }
+    heap_place(timer, i);
+}
+
+static void sift_down(int i) {
+    loop_timer_t *timer = timers[i];
+    while (2 * i + 1 < ntimers) {
+        int child = 2 * i + 1;
+        if (child + 1 < ntimers && timers[child + 1]->deadline < timers[child]->deadline) {
+            child++;
+        }
+        if (timers[child]->deadline >= timer->deadline) {
+            break;
+        }
+        heap_place(timers[child], i);
+        i = child;
+    }
+    heap_place(timer, i);
+}
+
+static void heap_remove(loop_timer_t *timer) {
+    int i = timer->index;
+    loop_timer_t *last = timers[--ntimers];
+    if (last != timer) {
+        heap_place(last, i);
+        sift_up(i);
+        sift_down(last->index);
+    }
+}
+
+// Point the timerfd at the earliest deadline, or disarm it
+static void arm_timer_fd(void) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (ntimers > 0) {
+        its.it_value.tv_sec = (time_t)(timers[0]->deadline / 1000000000ULL);
+        its.it_value.tv_nsec = (long)(timers[0]->deadline % 1000000000ULL);
+    }
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// Run every timer that is due. Returns the number that printed something
+static int handle_timer(void) {
+    uint64_t expirations;
+    int printed = 0;
+    if (read(timer_fd, &expirations, sizeof(expirations)) != (ssize_t)sizeof(expirations)) {
+        return 0;
+    }
+    uint64_t now = now_ns();
+    while (ntimers > 0 && timers[0]->deadline <= now) {
+        loop_timer_t *timer = timers[0];
+        heap_remove(timer);
+        loop_timer_fn fn = timer->fn;
+        void *arg = timer->arg;
+        free(timer);
+        printed += fn(arg); // may add timers of its own
+    }
+    arm_timer_fd();
+    return printed;
+}
+
+// Wait up to timeout ms (-1 = forever) and handle whatever is ready.
+// Returns 1 if stdin is readable, 0 if not, -1 on error
+static int run_once(int timeout, int *printed) {
+    struct epoll_event events[16];
+    int n = epoll_wait(epoll_fd, events, 16, timeout);
+    if (n == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+
+    int input_ready = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t data = events[i].data.u64;
+        if (data == SRC_STDIN) {
+            input_ready = 1; // also on hangup: the read will see EOF
+        } else if (data == SRC_SIGNAL) {
+            *printed += handle_signals();
+        } else if (data == SRC_TIMER) {
+            *printed += handle_timer();
+        } else if (data & SRC_FD) {
+            int fd = (int)(data & ~SRC_FD);
+            // May have been unwatched by an earlier event of this batch
+            if (fd < fd_watcher_cap && fd_watchers[fd].fn) {
+                *printed += fd_watchers[fd].fn(fd, fd_watchers[fd].arg);
+            }
+        } else {
+            *printed += handle_pid_exit(data);
+        }
+    }
+    return input_ready;
+}
+
+// Block until stdin has input (or EOF), handling everything else meanwhile.
+// Output printed while the prompt is showing is followed by a fresh prompt
+int loop_wait_stdin(void) {
+    if (getpid() != loop_owner || !stdin_polled) {
+        loop_dispatch_pending();
+        return 0;
+    }
+
+    while (1) {
+        int printed = 0;
+        int rc = run_once(-1, &printed);
+        if (printed > 0) {
+            display_prompt();
+        }
+        if (rc != 0) {
+            return rc == 1 ? 0 : -1;
+        }
+    }
+}
+
+// Handle signals and timers that are already due, without blocking
+void loop_dispatch_pending(void) {
+    if (getpid() != loop_owner) {
+        return;
+    }
+    int printed = 0;
+    mute_stdin(1);
+    run_once(0, &printed);
+    mute_stdin(0);
+}
+
+// Start tracking the stages of a foreground job (see loop_wait_foreground)
+// before anything else can run the loop. A forkless built-in stage does while
+// the spawned stages already run, and without pidfds its waitpid(-1) would
+// otherwise reap them as strays and lose their status. Returns -1 on failure
+int loop_expect_foreground(const pid_t *pids, int npids, int *statuses, struct rusage *usages) {
+    if (getpid() != loop_owner) {
+        return 0; // loop_wait_foreground waits for them itself
+    }
+    int *pidfds = malloc((size_t)npids * sizeof(int));
+    if (!pidfds) {
+        perror("malloc");
+        return -1;
+    }
+    fg_wait.pids = pids;
+    fg_wait.pidfds = pidfds;
+    fg_wait.npids = npids;
+    fg_wait.remaining = 0;
+    fg_wait.stopped = 0;
+    fg_wait.statuses = statuses;
+    fg_wait.usages = usages;
+    for (int i = 0; i < npids; i++) {
+        if (statuses) statuses[i] = -1;
+        pidfds[i] = pids[i] > 0 ? loop_watch_pid(pids[i]) : -1;
+        if (pids[i] > 0) fg_wait.remaining++;
+    }
+    return 0;
+}
+
+// Wait until every pid (0 entries are skipped) has exited or one of them stops.
+// Background jobs keep being reaped and reported meanwhile.
+// Returns 1 if the job stopped, 0 otherwise. statuses (optional, npids entries)
+// gets each pid's exit status, or -1 for one that has not exited (stopped job);
+// usages (optional) the resource usage of each pid that exited. The pids may
+// have been handed to loop_expect_foreground() already
+int loop_wait_foreground(const pid_t *pids, int npids, int *statuses, struct rusage *usages) {
+    int stopped = 0;
+
+    if (getpid() != loop_owner) {
+        // A forked child (e.g. log execute inside a pipeline) has no loop of its own
+        for (int i = 0; i < npids; i++) {
+            if (statuses) statuses[i] = -1;
+        }
+        for (int i = 0; i < npids && !stopped; i++) {
+            int status;
+            struct rusage usage;
+            if (pids[i] > 0 && wait4(pids[i], &status, WUNTRACED, &usage) > 0) {
+                stopped = WIFSTOPPED(status);
+                if (!stopped && statuses) statuses[i] = status;
+                if (!stopped && usages) usages[i] = usage;
+            }
+        }
+        return stopped;
+    }
+
+    fg_wait_t outer;
+    memset(&outer, 0, sizeof(outer));
+    if (fg_wait.pids != pids) {
+        outer = fg_wait; // set if a built-in waits while another job is expected
+        if (loop_expect_foreground(pids, npids, statuses, usages) == -1) {
+            fg_wait = outer;
+            return 0;
+        }
+    }
+
+    mute_stdin(1);
+    // The children may have finished before we got here: their pidfds are readable already
+    while (fg_wait.remaining > 0 && !fg_wait.stopped) {
+        int printed = 0;
+        if (run_once(-1, &printed) == -1) {
+            perror("epoll_wait");
+            break;
+        }
+    }
+    mute_stdin(0);
+
+    stopped = fg_wait.stopped;
+    for (int i = 0; i < npids; i++) {
+        if (fg_wait.pidfds[i] != -1) close(fg_wait.pidfds[i]);
+    }
+    free(fg_wait.pidfds);
+    fg_wait = outer;
+    return stopped;
+}
+
+// Call fn(arg) once, ms milliseconds from now. The handle is valid until the
+// timer fires or is cancelled. Returns NULL where the loop does not run (a
+// forked child) or on allocation failure
+loop_timer_t *loop_add_timer(unsigned long ms, loop_timer_fn fn, void *arg) {
+    if (getpid() != loop_owner || timer_fd == -1) {
+        return NULL;
+    }
+    if (ntimers == timer_cap) {
+        int cap = timer_cap ? timer_cap * 2 : 16;
+        loop_timer_t **grown = realloc(timers, (size_t)cap * sizeof(loop_timer_t *));
+        if (!grown) {
+            return NULL;
+        }
+        timers = grown;
+        timer_cap = cap;
+    }
+    loop_timer_t *timer = malloc(sizeof(loop_timer_t));
+    if (!timer) {
+        return NULL;
+    }
+    timer->deadline = now_ns() + (uint64_t)ms * 1000000ULL;
+    timer->fn = fn;
+    timer->arg = arg;
+    heap_place(timer, ntimers++);
+    sift_up(timer->index);
+    if (timer->index == 0) {
+        arm_timer_fd();
+    }
+    return timer;
+}
+
+void loop_cancel_timer(loop_timer_t *timer) {
+    if (!timer) {
+        return;
+    }
+    int was_first = timer->index == 0;
+    heap_remove(timer);
+    free(timer);
+    if (was_first) {
+        arm_timer_fd();
+    }
+}
+
+// Call fn(fd, arg) whenever fd is readable or hung up, until loop_unwatch_fd().
+// Returns -1 where the loop does not run (a forked child) or on error
+int loop_watch_fd(int fd, loop_fd_fn fn, void *arg) {
+    if (getpid() != loop_owner || fd < 0) {
+        return -1;
+    }
+    if (fd >= fd_watcher_cap) {
+        int cap = fd_watcher_cap ? fd_watcher_cap : 64;
+        while (cap <= fd) cap *= 2;
+        fd_watcher_t *grown = realloc(fd_watchers, (size_t)cap * sizeof(fd_watcher_t));
+        if (!grown) {
+            return -1;
+        }
+        memset(grown + fd_watcher_cap, 0, (size_t)(cap - fd_watcher_cap) * sizeof(fd_watcher_t));
+        fd_watchers = grown;
+        fd_watcher_cap = cap;
+    }
+    if (watch(fd, SRC_FD | (uint64_t)fd) == -1) {
+        return -1;
+    }
+    fd_watchers[fd].fn = fn;
+    fd_watchers[fd].arg = arg;
+    return 0;
+}
+
+// Stop watching fd; call before closing it
+void loop_unwatch_fd(int fd) {
+    if (fd < 0 || fd >= fd_watcher_cap || !fd_watchers[fd].fn) {
+        return;
+    }
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    fd_watchers[fd].fn = NULL;
+    fd_watchers[fd].arg = NULL;
+}
+
+// Serve the loop (jobs, timers, watched fds) until done(arg) holds.
+// Returns 0 then, or -1 on Ctrl-C or an error
+int loop_wait_until(loop_done_fn done, void *arg) {
+    if (getpid() != loop_owner) {
+        return done(arg) ? 0 : -1;
+    }
+    int rc = 0;
+    interrupted = 0;
+    mute_stdin(1);
+    while (!done(arg)) {
+        int printed = 0;
+        if (run_once(-1, &printed) == -1) {
+            perror("epoll_wait");
+            rc = -1;
+            break;
+        }
+        if (interrupted) {
+            rc = -1;
+            break;
+        }
+    }
+    mute_stdin(0);
+    interrupted = 0;
+    return rc;
+}
@@ -1,5 +1,13 @@
 #include "shell.h"
+#include "ast.h"
 #include "bg_jobs.h"
+#include "launch.h"
+#include "intrinsics.h"
+#include "eventloop.h"
+#include "cgroup.h"
+#include "watchdog.h"
+#include "joblog.h"
+#include "history.h"
 #include <sys/wait.h>
 #include <unistd.h>
 #include <errno.h>
@@ -9,637 +17,219 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
+#include <time.h>
 
-// Parse command line into argc and argv
-static int parse_command_line(const char *input, char **argv, int max_args) {
-    int argc = 0;
-    int len = strlen(input);
-    int i = 0;
-    
-    // Skip leading whitespace
-    while (i < len && isspace(input[i])) i++;
-    
-    while (i < len && argc < max_args - 1) {
-        // Find start of argument
-        while (i < len && isspace(input[i])) i++;
-        if (i >= len) break;
-        
-        int start = i;
-        
-        // Find end of argument
-        while (i < len && !isspace(input[i])) i++;
-        
-        // Copy argument
-        int arg_len = i - start;
-        argv[argc] = malloc(arg_len + 1);
-        strncpy(argv[argc], input + start, arg_len);
-        argv[argc][arg_len] = '\0';
-        argc++;
-    }
-    
-    argv[argc] = NULL; // Null terminate
-    return argc;
+#define LINE_ARENA_BLOCK 4096
+#define QUEUED_ARENA_BLOCK 512
+
+// Owns every transient allocation of the line being executed (AST, stage tables,
+// pipe/pid arrays). Released when the line finishes; forked children inherit it as-is.
+static arena_t line_arena = { NULL, NULL, LINE_ARENA_BLOCK };
+
+// How the line being run went, for its history record
+static int line_status = 0;   // $?-style status of its last foreground cmd_group
+static int line_job_id = 0;   // last job it started or stopped
+
+// $?-style status from a wait status: the exit code, or 128 + the signal
+static int exit_code(int wait_status) {
+    if (WIFEXITED(wait_status)) return WEXITSTATUS(wait_status);
+    if (WIFSIGNALED(wait_status)) return 128 + WTERMSIG(wait_status);
+    return 0;
 }
-// make a list of all arguments and store like ls -l acbd will be stores as [ls, l, abcd, NULL]
-// Free allocated argv memory
-static void free_argv(char **argv, int argc) {
-    for (int i = 0; i < argc; i++) {
-        free(argv[i]);
-    }
+
+// Name a job after its command, without any leading path
+static const char *job_name(const atomic_t *cmd) {
+    const char *slash = strrchr(cmd->argv[0], '/');
+    return slash ? slash + 1 : cmd->argv[0];
 }
 
-// Local trim function that returns a newly allocated trimmed copy
-static char* str_trim_new(const char *s) {
-    if (!s) return NULL;
-    const char *start = s;
-    while (*start && isspace(*start)) start++;
-    const char *end = s + strlen(s);
-    if (end > start) {
-        end--;
-        while (end > start && isspace(*end)) end--;
-        end++;
-    }
-    size_t n = (size_t)(end - start);
-    char *out = malloc(n + 1);
-    memcpy(out, start, n);
-    out[n] = '\0';
-    return out;
-} // removes trailing and leading whitespace 
-
-// Check if command contains 'log' anywhere in the pipeline
-static int contains_log_command(const char *input) {
-    if (!input) return 0;
-    
-    // Create a copy to tokenize
-    char *input_copy = strdup(input);
-   // char *token;
-    // char *saveptr;
-    
-    // Split by various separators to check each command part
-    char *current = input_copy;
-    while (current && *current) {
-        // Find next separator (|, ;, &)
-        char *next_sep = NULL;
-        char *pipe_pos = strchr(current, '|');
-        char *semi_pos = strchr(current, ';');
-        char *amp_pos = strchr(current, '&');
-        
-        // Find the earliest separator
-        next_sep = pipe_pos;
-        if (semi_pos && (!next_sep || semi_pos < next_sep)) next_sep = semi_pos;
-        if (amp_pos && (!next_sep || amp_pos < next_sep)) next_sep = amp_pos;
-        
-        // Extract current command segment
-        char *segment;
-        if (next_sep) {
-            *next_sep = '\0';
-            segment = str_trim_new(current);
-            current = next_sep + 1;
-        } else {
-            segment = str_trim_new(current);
-            current = NULL;
-        }
-        
-        // Check if this segment starts with 'log'
-        if (segment && strlen(segment) >= 3) {
-            if (strncmp(segment, "log", 3) == 0 && 
-                (segment[3] == '\0' || isspace(segment[3]))) {
-                free(segment);
-                free(input_copy);
+// Check if 'log' is the command of any stage anywhere in the line
+static int contains_log_command(const shell_ast_t *ast) {
+    for (const pipeline_t *p = ast->pipelines; p; p = p->next) {
+        for (const atomic_t *a = p->stages; a; a = a->next) {
+            if (strcmp(a->argv[0], "log") == 0) {
                 return 1;
             }
         }
-        
-        free(segment);
     }
-    
-    free(input_copy);
     return 0;
-} // check if log is there ANYWHERE in pipeline 
-
-// Extract both input and output redirections from a single command string.
-// Returns clean_command (no redirection tokens), last input filename, last output filename, and append flag.
-// FAILS FAST on first redirection error like bash does
-static void extract_redirections(const char *input,
-    char **clean_command,
-    char **in_filename,
-    char **out_filename,
-    int *out_append,
-    int *error_occurred)  // New parameter to indicate if any error occurred
-{
-    *clean_command = NULL; // command without redirections
-    *in_filename = NULL; // input filename
-    *out_filename = NULL; // output filename
-    *error_occurred = 0; // indicates error
-    if (out_append) *out_append = 0; // >> what file to append to
-    if (!input) return;
-
-    size_t n = strlen(input);
-    char *clean = malloc(n + 1);
-    int clean_len = 0;
-    char *last_in = NULL;
-    char *last_out = NULL;
-    int last_out_app = 0;
-    // track the most recent input/output filenames
-
-    int i = 0;
-    while (i < (int)n && !*error_occurred) {  // STOP on first error
-        while (i < (int)n && isspace(input[i])) i++;
-        if (i >= (int)n) break;
-        int start = i;
-        while (i < (int)n && !isspace(input[i])) i++;
-        int tok_len = i - start;
-        if (tok_len == 0) continue; // loops over tokens separated by whitespace 
-
-        // Check for standalone redirection operators
-        if (tok_len == 1 && input[start] == '<') {
-            // read filename
-            while (i < (int)n && isspace(input[i])) i++;
-            int fstart = i;
-            while (i < (int)n && !isspace(input[i])) i++;
-            int flen = i - fstart;
-            if (flen > 0) {
-                char *fname = strndup(input + fstart, flen);
-                // Try to open the file to check for errors - FAIL IMMEDIATELY
-                int fd = open(fname, O_RDONLY);
-                if (fd == -1) {
-                    fprintf(stderr, "No such file or directory\n");
-                    *error_occurred = 1;
-                    free(fname);
-                    // Clean up any previously allocated filenames
-                    if (last_in) free(last_in);
-                    if (last_out) free(last_out);
-                    last_in = NULL;
-                    last_out = NULL;
-                    break; // STOP PROCESSING
-                } else {
-                    close(fd);
-                    if (last_in) free(last_in);  // Free previous input file
-                    last_in = fname;
-                }
-            }
-            continue;
-        }
-        
-        if (input[start] == '>' && tok_len >= 1) {
-            int is_append = 0;
-            int redirect_len = 1;
-            
-            if (tok_len >= 2 && input[start] == '>' && input[start + 1] == '>') {
-                is_append = 1;
-                redirect_len = 2;
-            }
-            
-            char *fname = NULL;
-            // Check if it's a standalone operator
-            if (tok_len == redirect_len) {
-                while (i < (int)n && isspace(input[i])) i++;
-                int fstart = i;
-                while (i < (int)n && !isspace(input[i])) i++;
-                int flen = i - fstart;
-                if (flen > 0) {
-                    fname = strndup(input + fstart, flen);
-                }
-            } 
-            // Check if it's attached redirection
-            else if (tok_len > redirect_len) {
-                int fname_start = start + redirect_len;
-                int fname_len = tok_len - redirect_len;
-                if (fname_len > 0) {
-                    fname = strndup(input + fname_start, fname_len);
-                }
+} // check if log is there ANYWHERE in pipeline
+
+// Walk a command's redirections in order and open each target exactly once.
+// The last input and the last output win; their descriptors (O_CLOEXEC, -1 for
+// none) are handed to the stage and dup2'd into place, never reopened by name.
+// FAILS FAST on the first error like bash does, leaving nothing open
+static int resolve_redirections(const atomic_t *cmd, int *in_fd, int *out_fd) {
+    *in_fd = -1;
+    *out_fd = -1;
+
+    for (const redirect_t *r = cmd->redirects; r; r = r->next) {
+        int fd;
+        if (r->type == REDIR_INPUT) {
+            fd = open(r->target, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                fprintf(stderr, "No such file or directory\n");
             }
-
-            if (fname) {
-                // Try to open the file to check for errors - FAIL IMMEDIATELY
-                int flags = O_WRONLY | O_CREAT;
-                flags |= (is_append ? O_APPEND : O_TRUNC);
-                int fd = open(fname, flags, 0644);
-                if (fd == -1) {
-                    fprintf(stderr, "Unable to create file for writing");
-                    *error_occurred = 1;
-                    free(fname);
-                    // Clean up any previously allocated filenames
-                    if (last_in) free(last_in);
-                    if (last_out) free(last_out);
-                    last_in = NULL;
-                    last_out = NULL;
-                    break; // STOP PROCESSING
-                } else {
-                    close(fd);
-                    if (last_out) free(last_out);  // Free previous output file
-                    last_out = fname;
-                    last_out_app = is_append;
-                }
+        } else {
+            int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+            flags |= (r->type == REDIR_APPEND ? O_APPEND : O_TRUNC);
+            fd = open(r->target, flags, 0644);
+            if (fd == -1) {
+                fprintf(stderr, "Unable to create file for writing\n");
             }
-            continue;
         }
-        
-        // Check for attached input redirection
-        if (input[start] == '<' && tok_len > 1) {
-            int fname_start = start + 1;
-            int fname_len = tok_len - 1;
-            if (fname_len > 0) {
-                char *fname = strndup(input + fname_start, fname_len);
-                // Try to open the file to check for errors - FAIL IMMEDIATELY
-                int fd = open(fname, O_RDONLY);
-                if (fd == -1) {
-                    fprintf(stderr, "bash: %s: %s\n", fname, strerror(errno));
-                    *error_occurred = 1;
-                    free(fname);
-                    // Clean up any previously allocated filenames
-                    if (last_in) free(last_in);
-                    if (last_out) free(last_out);
-                    last_in = NULL;
-                    last_out = NULL;
-                    break; // STOP PROCESSING
-                } else {
-                    close(fd);
-                    if (last_in) free(last_in);  // Free previous input file
-                    last_in = fname;
-                }
-            }
-            continue;
+        if (fd == -1) {
+            if (*in_fd != -1) close(*in_fd);
+            if (*out_fd != -1) close(*out_fd);
+            *in_fd = -1;
+            *out_fd = -1;
+            return -1;
         }
 
-        // Normal argument - append to clean command
-        if (clean_len > 0) clean[clean_len++] = ' ';
-        memcpy(clean + clean_len, input + start, tok_len);
-        clean_len += tok_len;
-    }
-
-    clean[clean_len] = '\0';
-    *clean_command = str_trim_new(clean);
-    free(clean);
-    
-    // Only set output parameters if no error occurred
-    if (*error_occurred) {
-        *in_filename = NULL;
-        *out_filename = NULL;
-        if (out_append) *out_append = 0;
-    } else {
-        *in_filename = last_in;
-        *out_filename = last_out;
-        if (out_append) *out_append = last_out_app;
+        // An earlier target of the same direction has been created/checked; drop it
+        int *slot = r->type == REDIR_INPUT ? in_fd : out_fd;
+        if (*slot != -1) close(*slot);
+        *slot = fd;
     }
+    return 0;
 }
 // ============================ LLM GENERATED CODE BEGINS ==============================================
 // Setup input redirection for a command - FIXED error handling
-int setup_input_redirection(const char *filename) {
-    if (!filename || strlen(filename) == 0) {
+// fd was opened by resolve_redirections() and stays owned by the caller
+int setup_input_redirection(int fd) {
+    if (fd < 0) {
         return 0;
     }
-    
-    // Open the file for reading
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1) {
-        fprintf(stderr, "No such file or directory\n");
-        return -1;
-    }
-    
+
     // Redirect stdin to the file
     if (dup2(fd, STDIN_FILENO) == -1) {
         perror("dup2");
-        close(fd);
         return -1;
     }
-    
-    // Close the original file descriptor
-    close(fd);
-    
+
     return 0;
 }
 
 // Setup output redirection for a command - FIXED error handling
-static int setup_output_redirection(const char *filename, int append) {
-    if (!filename || strlen(filename) == 0) {
+static int setup_output_redirection(int fd) {
+    if (fd < 0) {
         return 0;
     }
-    int flags = append ? (O_WRONLY | O_CREAT | O_APPEND) : (O_WRONLY | O_CREAT | O_TRUNC);
-    int fd = open(filename, flags, 0644);
-    if (fd == -1) {
-        fprintf(stderr, "Unable to create file for writing\n");
-        return -1;
-    }
     if (dup2(fd, STDOUT_FILENO) == -1) {
         perror("dup2"); // Makes the file descriptor fd replace the standard output.
 
 //From now on, the command will write to the file instead of the terminal.
-        close(fd);
         return -1;
     }
-    close(fd);
     return 0;
 }
     // ======================================= LLM GENERATED CODE ENDS ==================================================
-// Split a command line by pipes into an array of strings. Returns count. Allocates results.
-static int split_pipeline(const char *input, char ***out_cmds) {
-    int count = 1;
-    for (const char *p = input; *p; ++p) if (*p == '|') count++; // splits at pipw
-    char **parts = calloc((size_t)count, sizeof(char*));
-    int idx = 0;
-    const char *seg_start = input;
-    for (const char *p = input; ; ++p) {
-        if (*p == '|' || *p == '\0') {
-            char *segment = strndup(seg_start, (size_t)(p - seg_start));
-            char *trimmed = str_trim_new(segment);
-            free(segment);
-            parts[idx++] = trimmed;
-            if (*p == '\0') break;
-            seg_start = p + 1;
-        }
-    }
-    *out_cmds = parts;
-    return idx;
-} // splits command line into pipe segments 
-
-// Free array from split_pipeline
-static void free_pipeline(char **cmds, int count) {
-    for (int i = 0; i < count; ++i) free(cmds[i]);
-    free(cmds);
-}
-
-// ============================== LLM GENERATED CODE BEGINS ==============================================
-static int split_sequential_with_bg(const char *input, char ***out_cmds, int **out_bg_flags) {
-    int count = 0; // splits based on ; sequential operators (allows one after the other execution) and respects & bg operators 
-    int capacity = 10;
-    char **parts = malloc(capacity * sizeof(char*));
-    int *bg_flags = malloc(capacity * sizeof(int));
-    
-    const char *start = input;
-    int in_quote = 0;
-    char quote_char = 0;
-    
-    for (const char *p = input; ; ++p) {
-        if (*p == '\0' || (!in_quote && *p == ';')) {
-            // Extract segment up to semicolon or end
-            size_t len = p - start;
-            char *segment = malloc(len + 1);
-            strncpy(segment, start, len);
-            segment[len] = '\0';
-            
-            // Now process this segment for & operators
-            const char *seg_start = segment;
-            const char *seg_p = segment;
-            
-            while (*seg_p) {
-                if (*seg_p == '&' && !in_quote) {
-                    // Found & - extract command before it
-                    size_t cmd_len = seg_p - seg_start;
-                    if (cmd_len > 0) {
-                        char *cmd = malloc(cmd_len + 1);
-                        strncpy(cmd, seg_start, cmd_len);
-                        cmd[cmd_len] = '\0';
-                        
-                        char *trimmed = str_trim_new(cmd);
-                        free(cmd);
-                        
-                        if (strlen(trimmed) > 0) {
-                            if (count >= capacity) {
-                                capacity *= 2;
-                                parts = realloc(parts, capacity * sizeof(char*));
-                                bg_flags = realloc(bg_flags, capacity * sizeof(int));
-                            }
-                            parts[count] = trimmed;
-                            bg_flags[count] = 1; // This command is background
-                            count++;
-                        } else {
-                            free(trimmed);
-                        }
-                    }
-                    
-                    // Move past the &
-                    seg_p++;
-                    while (*seg_p && isspace(*seg_p)) seg_p++;
-                    seg_start = seg_p;
-                    continue;
-                }
-                
-                if (*seg_p == '\'' || *seg_p == '"') {
-                    if (!in_quote) {
-                        in_quote = 1;
-                        quote_char = *seg_p;
-                    } else if (*seg_p == quote_char) {
-                        in_quote = 0;
-                    }
-                }
-                seg_p++;
-            }
-            
-            // Handle remaining part after last & (or entire segment if no &)
-            if (seg_start < seg_p) {
-                size_t remaining_len = seg_p - seg_start;
-                char *remaining = malloc(remaining_len + 1);
-                strncpy(remaining, seg_start, remaining_len);
-                remaining[remaining_len] = '\0';
-                // ignores semicolons inside quotes
-                char *trimmed = str_trim_new(remaining);
-                free(remaining);
-                // takes segments separated by ;
-                if (strlen(trimmed) > 0) {
-                    if (count >= capacity) {
-                        capacity *= 2;
-                        parts = realloc(parts, capacity * sizeof(char*));
-                        bg_flags = realloc(bg_flags, capacity * sizeof(int));
-                    }
-                    parts[count] = trimmed;
-                    bg_flags[count] = 0; // This command is foreground
-                    count++;
-                } else {
-                    free(trimmed);
-                }
-            }
-            // ======================= LLM GENERATED CODE ENDS ===========================================
-            
-            free(segment);
-            if (*p == '\0') break;
-            start = p + 1;
-        }
-        else if (*p == '\'' || *p == '"') {
-            if (!in_quote) {
-                in_quote = 1;
-                quote_char = *p;
-            } else if (*p == quote_char) {
-                in_quote = 0;
-            }
-        }
-    }
-    
-    *out_cmds = parts;
-    *out_bg_flags = bg_flags;
-    return count;
-}
 
-// Free array from split_sequential_with_bg
-static void free_sequential_with_bg(char **cmds, int *bg_flags, int count) {
-    for (int i = 0; i < count; ++i) free(cmds[i]);
-    free(cmds);
-    free(bg_flags);
+// One pipeline stage with its redirections resolved
+typedef struct {
+    const atomic_t *cmd;
+    const intrinsic_t *builtin; // NULL for an external command
+    int in_fd;                  // '<' target, -1 for none
+    int out_fd;                 // '>' / '>>' target, -1 for none
+    int forkless;               // built-in run inside the shell, see runs_forkless()
+} pipeline_stage_t;
+
+// Run a built-in stage of a pipeline, MEANT TO BE CALLED INSIDE CHILD PROCESS BY FORK()
+// launch_fork() already put the pipe ends or redirection targets on stdin/stdout
+static void exec_single_command(const pipeline_stage_t *stage) {
+    int argc = stage->cmd->argc;
+    char **argv = stage->cmd->argv;
+
+    stage->builtin->fn(argc, argv);
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
 }
 
-// Execute a single command string (no pipes), supporting <, >, >>
-// FIXED: Proper redirection order - file redirections only apply if they don't conflict with pipes
-static void exec_single_command(const char *cmdline) {
-    // executes a single command string , handles I/O, builtins, externals, MEANT TO BE CALLED INSIDE CHILD PROCESS BY FORK()
-
-    char *clean = NULL;
-    char *in_file = NULL;
-    char *out_file = NULL;
-    int out_append = 0;
-    int error_occurred = 0;
-    
-    extract_redirections(cmdline, &clean, &in_file, &out_file, &out_append, &error_occurred);
-    
-    if (error_occurred) {
-        free(clean);
-        free(in_file);
-        free(out_file);
-        exit(EXIT_FAILURE);
-    }
-
-    char *argv[64];
-    int argc = parse_command_line(clean ? clean : "", argv, 64);
-    if (argc == 0) {
-        free(clean);
-        free(in_file);
-        free(out_file);
-        exit(EXIT_SUCCESS);
+// Built-ins that act on the shell itself cannot be moved into a child
+static int refuse_in_child(const pipeline_stage_t *stage) {
+    if (stage->builtin->flags & INTRINSIC_PARENT) {
+        fprintf(stderr, "%s: can only run in the foreground\n", stage->builtin->name);
+        return 1;
     }
+    return 0;
+}
 
-    // Check if stdin/stdout are already redirected (from pipes)
-    int stdin_is_pipe = !isatty(STDIN_FILENO);
-    int stdout_is_pipe = !isatty(STDOUT_FILENO);
-    
-    // Apply input redirection ONLY if stdin is not already redirected from a pipe
-    // AND if we have an explicit input file
-    if (in_file && !stdin_is_pipe) {
-        if (setup_input_redirection(in_file) == -1) {
-            free_argv(argv, argc);
-            free(clean); free(in_file); free(out_file);
-            exit(EXIT_FAILURE);
-        }
-    }
-    
-    // Apply output redirection ONLY if stdout is not already redirected to a pipe
-    // AND if we have an explicit output file
-    if (out_file && !stdout_is_pipe) {
-        if (setup_output_redirection(out_file, out_append) == -1) {
-            free_argv(argv, argc);
-            free(clean); free(in_file); free(out_file);
-            exit(EXIT_FAILURE);
-        }
+// A built-in pipeline stage can run inside the shell process unless it needs a
+// process of its own; log execute launches whole command lines, so it keeps
+// its child. A stdin reader also needs one when some stage before it runs in
+// the shell: forkless stages run last to first, so that input would only be
+// written after it has been read
+static int runs_forkless(const pipeline_stage_t *stage, int upstream_forkless) {
+    const intrinsic_t *builtin = stage->builtin;
+    if (!builtin || !(builtin->flags & INTRINSIC_PIPE_SAFE)) {
+        return 0;
     }
-
-    // Built-ins in child (simple route)
-    if (strcmp(argv[0], "hop") == 0) {
-        hop(argc, argv);
-        free_argv(argv, argc);
-        free(clean); free(in_file); free(out_file);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(argv[0], "reveal") == 0) {
-        reveal(argc, argv);
-        free_argv(argv, argc);
-        free(clean); free(in_file); free(out_file);
-        exit(EXIT_SUCCESS);
-    } else if (strcmp(argv[0], "log") == 0) {
-        log_command(argc, argv);
-        free_argv(argv, argc);
-        free(clean); free(in_file); free(out_file);
-        exit(EXIT_SUCCESS);
+    if (upstream_forkless && (builtin->flags & INTRINSIC_READS_STDIN)) {
+        return 0;
     }
-
-    // External command
-    if (execvp(argv[0], argv) == -1) {
-        fprintf(stderr, "Command not found!\n");
-        free_argv(argv, argc);
-        free(clean); free(in_file); free(out_file);
-        _exit(127);
+    if (strcmp(builtin->name, "log") == 0 && stage->cmd->argc > 1 &&
+        strcmp(stage->cmd->argv[1], "execute") == 0) {
+        return 0;
     }
+    return 1;
 }
 
-// Check if a command is a built-in
-static int is_builtin(const char *cmd) {
-    return (strcmp(cmd, "hop") == 0 || 
-            strcmp(cmd, "reveal") == 0 || 
-            strcmp(cmd, "log") == 0 ||
-            strcmp(cmd, "activities") == 0 ||
-            strcmp(cmd, "ping") == 0 ||
-            strcmp(cmd, "fg") == 0 ||
-            strcmp(cmd, "bg") == 0);
-} 
-// Execute a built-in command in the current process with redirection support
-static void execute_builtin(const char *cmdline) {
-    char *clean = NULL;
-    char *in_file = NULL;
-    char *out_file = NULL;
-    int out_append = 0;
-    int error_occurred = 0;
-    
-    extract_redirections(cmdline, &clean, &in_file, &out_file, &out_append, &error_occurred);
-    
-    if (error_occurred) {
-        free(clean);
-        free(in_file);
-        free(out_file);
-        return;
-    }
+// A forkless stage that reads the pipe in front of it inside the shell
+static int reads_pipe_forkless(const pipeline_stage_t *stage) {
+    return stage->forkless && (stage->builtin->flags & INTRINSIC_READS_STDIN);
+}
 
-    char *argv[64];
-    int argc = parse_command_line(clean ? clean : "", argv, 64);
-    if (argc == 0) {
-        free(clean);
-        free(in_file);
-        free(out_file);
-        return;
-    }
+// Execute a built-in command in the current process with redirection support.
+// stdin_fd / stdout_fd (pipe ends, -1 for none) become stdin / stdout unless
+// the stage has its own '<' / '>'. While it runs, the shell's own stdout is
+// kept for job notices and admitted jobs (see set_shell_stdout)
+static void execute_builtin(const pipeline_stage_t *stage, int stdin_fd, int stdout_fd) {
+    int argc = stage->cmd->argc;
+    char **argv = stage->cmd->argv;
 
     // Save original stdin/stdout for restoration
     int saved_stdin = -1, saved_stdout = -1;
-    
+
     // Setup input redirection if needed
-    if (in_file) {
+    if (stage->in_fd != -1) {
+        stdin_fd = stage->in_fd;
+    }
+    if (stdin_fd != -1) {
         saved_stdin = dup(STDIN_FILENO);
-        if (saved_stdin == -1 || setup_input_redirection(in_file) == -1) {
+        if (saved_stdin == -1 || setup_input_redirection(stdin_fd) == -1) {
             if (saved_stdin != -1) close(saved_stdin);
-            free_argv(argv, argc);
-            free(clean); free(in_file); free(out_file);
             return;
         }
     }
-    
+
     // Setup output redirection if needed
-    if (out_file) {
+    if (stage->out_fd != -1) {
+        stdout_fd = stage->out_fd;
+    }
+    if (stdout_fd != -1) {
+        fflush(stdout); // nothing written so far may end up in the new target
         saved_stdout = dup(STDOUT_FILENO);
-        if (saved_stdout == -1 || setup_output_redirection(out_file, out_append) == -1) {
+        if (saved_stdout == -1 || setup_output_redirection(stdout_fd) == -1) {
             if (saved_stdout != -1) close(saved_stdout);
             if (saved_stdin != -1) {
                 dup2(saved_stdin, STDIN_FILENO);
                 close(saved_stdin);
             }
-            free_argv(argv, argc);
-            free(clean); free(in_file); free(out_file);
             return;
         }
     }
 
     // Execute the built-in command
-    if (strcmp(argv[0], "hop") == 0) {
-        hop(argc, argv);
-    } else if (strcmp(argv[0], "reveal") == 0) {
-        reveal(argc, argv);
-    } else if (strcmp(argv[0], "log") == 0) {
-        log_command(argc, argv);
-    } else if (strcmp(argv[0], "activities") == 0) {
-        activities(argc, argv);
-    } else if (strcmp(argv[0], "ping") == 0) {
-        ping(argc, argv);
-    } else if (strcmp(argv[0], "fg") == 0) {
-        fg(argc, argv);
-    } else if (strcmp(argv[0], "bg") == 0) {
-        bg(argc, argv);
+    int outer_stdout = get_shell_stdout();
+    if (saved_stdout != -1 && outer_stdout == -1) {
+        set_shell_stdout(saved_stdout);
     }
-    
+    stage->builtin->fn(argc, argv);
+    set_shell_stdout(outer_stdout);
+
     // Restore original stdin/stdout
+    fflush(stdout);
     if (saved_stdin != -1) {
         dup2(saved_stdin, STDIN_FILENO);
         close(saved_stdin);
@@ -649,409 +239,657 @@ static void execute_builtin(const char *cmdline) {
         close(saved_stdout);
     }
 
-    free_argv(argv, argc);
-    free(clean); free(in_file); free(out_file);
     fflush(stdout);
     fflush(stderr);
 }
-// ======================== LLM GENERATED CODE BEGINS =======================================
-// Execute a single complete shell command (may contain pipes, but no semicolons)
-static void execute_single_shell_command(const char *input, int is_background) {
-    if (!input || strlen(input) == 0) {
+
+// The shell's copies of a stage's redirection targets; children keep their own
+static void close_stage_fds(pipeline_stage_t *stage) {
+    if (stage->in_fd != -1) {
+        close(stage->in_fd);
+        stage->in_fd = -1;
+    }
+    if (stage->out_fd != -1) {
+        close(stage->out_fd);
+        stage->out_fd = -1;
+    }
+}
+
+// What the prefixes of a cmd_group (limit, timeout) ask of its processes
+typedef struct {
+    job_limits_t limits;
+    int limited;
+    unsigned long timeout_ms;    // 0 = no deadline
+    unsigned long grace_ms;
+    job_watchdog_t *watchdog;    // armed once the group's processes exist
+} group_prefix_t;
+
+// Put the processes of a limit ... cmd_group in its cgroup, or else cap them
+// one by one: RLIMIT_AS for memory, and niceness as the nearest stand-in for
+// a CPU share
+static void apply_job_limits(launch_opts_t *opts, const group_prefix_t *prefix) {
+    if (!prefix || !prefix->limited) {
         return;
     }
+    const job_limits_t *limits = &prefix->limits;
+    if (limits->cgroup) {
+        opts->cgroup_fd = cgroup_fd(limits->cgroup);
+        return;
+    }
+    opts->mem_limit = limits->mem_bytes;
+    if (limits->cpu_percent > 0 && limits->cpu_percent < 100) {
+        opts->nice = (100 - limits->cpu_percent) * 19 / 100;
+    }
+}
 
-    // Check if this is a simple built-in command (no pipes)
-    if (strchr(input, '|') == NULL) {
-        // No pipes - check if it's a built-in
-        char *clean = NULL;
-        char *in_file = NULL;
-        char *out_file = NULL;
-        int out_append = 0;
-        int error_occurred = 0;
-        
-        // Extract redirections and check for errors
-        extract_redirections(input, &clean, &in_file, &out_file, &out_append, &error_occurred);
-        
-        if (error_occurred) {
-            free(clean);
-            free(in_file);
-            free(out_file);
-            return;
-        }
-        
-        char *argv[64];
-        int argc = parse_command_line(clean ? clean : "", argv, 64);
-        
-        if (argc > 0 && is_builtin(argv[0])) {
-            if (is_background) {
-                // For background built-ins, fork and execute in child process
-                pid_t pid = fork();
-                if (pid == -1) {
-                    perror("fork");
-                } else if (pid == 0) {
-                    // Child process - execute built-in
-                    // Set new process group for background job
-                    setpgid(0, 0);
-                    // Redirect stdin from /dev/null for background processes
-                    freopen("/dev/null", "r", stdin);
-                    
-                    execute_builtin(input);
-                    exit(EXIT_SUCCESS);
-                } else {
-                    // Parent process - track background job
-                    setpgid(pid, pid);
-                    char *cmd_copy = strdup(input);
-                    char *first_token = strtok(cmd_copy, " \t\n");
-                    if (first_token) {
-                        char *cmd_name = strrchr(first_token, '/');
-                        cmd_name = cmd_name ? cmd_name + 1 : first_token;
-                        add_background_job(pid, cmd_name);
-                    }
-                    free(cmd_copy);
-                }
-            } else {
-                // Execute built-in in current process
-                execute_builtin(input);
+// Start the deadline of a timeout ... cmd_group, now that its process group exists
+static void arm_deadline(group_prefix_t *prefix, pid_t pgid) {
+    if (!prefix || prefix->timeout_ms == 0 || prefix->watchdog || pgid <= 0) {
+        return;
+    }
+    prefix->watchdog = watchdog_start(pgid, prefix->timeout_ms, prefix->grace_ms);
+    if (!prefix->watchdog) {
+        fprintf(stderr, "timeout: no deadline can be kept here\n");
+    }
+}
+
+// The cmd_group became job job_id: the job owns its cgroup and deadline from now on
+static void adopt_prefix(int job_id, group_prefix_t *prefix) {
+    bg_job_t *job = prefix && job_id > 0 ? find_job_by_number(job_id) : NULL;
+    if (job) {
+        job->cgroup = prefix->limits.cgroup;
+        job->watchdog = prefix->watchdog;
+        prefix->limits.cgroup = NULL;
+        prefix->watchdog = NULL;
+    }
+}
+
+// Run a single atomic whose redirections are already open: built-ins run
+// in the shell, everything else is spawned
+static void run_simple_command(const pipeline_stage_t *stage, int is_background, group_prefix_t *prefix) {
+    const atomic_t *cmd = stage->cmd;
+
+    if (stage->builtin) {
+        if (is_background) {
+            if (refuse_in_child(stage)) {
+                return;
             }
-            free_argv(argv, argc);
-            free(clean); free(in_file); free(out_file);
-            return;
-        }
-        
-        // Clean up temporary parsing
-        free_argv(argv, argc);
-        free(clean); free(in_file); free(out_file);
-        
-        // Not a built-in, fork and execute as external command
-        pid_t pid = fork();
-        if (pid == -1) {
-            perror("fork");
-            return;
-        } else if (pid == 0) {
-            // Child process
-            
-            // Create new process group for job control
-            setpgid(0, 0);
-            
-            if (is_background) {
-                // Redirect stdin from /dev/null for background processes
-                freopen("/dev/null", "r", stdin);
-            } else {
-                // Give terminal control to foreground process group
-                tcsetpgrp(STDIN_FILENO, getpid());
+            // For background built-ins, fork and execute in child process
+            // (new process group, stdin from /dev/null)
+            launch_opts_t opts;
+            launch_opts_init(&opts);
+            opts.background = 1;
+            job_output_t *out = joblog_open(&opts.stderr_fd);
+            opts.stdout_fd = opts.stderr_fd;
+            pid_t pid = launch_fork(&opts);
+            if (pid == 0) {
+                // Child process - execute built-in
+                execute_builtin(stage, -1, -1);
+                exit(EXIT_SUCCESS);
             }
-            
-            exec_single_command(input);
-            // never returns
-        } else {
-            // Parent process
-            
-            // Set process group for the child
-            setpgid(pid, pid);
-            
-            if (is_background) {
-                // Extract command name for job tracking
-                char *cmd_copy = strdup(input);
-                char *first_token = strtok(cmd_copy, " \t\n");
-                if (first_token) {
-                    // Get just the command name without path
-                    char *cmd_name = strrchr(first_token, '/');
-                    cmd_name = cmd_name ? cmd_name + 1 : first_token;
-                    add_background_job(pid, cmd_name);
-                }
-                free(cmd_copy);
+            if (out) {
+                close(opts.stderr_fd);
+            }
+            if (pid > 0) {
+                // Parent process - track background job
+                line_job_id = add_background_job(pid, job_name(cmd));
+                joblog_bind(out, line_job_id);
             } else {
-                // Set as foreground process for signal handling
-                set_foreground_process(pid, pid);
-                
-                // Wait for foreground process
-                int status;
-                pid_t result = waitpid(pid, &status, WUNTRACED);
-                
-                if (result > 0 && WIFSTOPPED(status)) {
-                    // Process was stopped (Ctrl-Z), move to background
-                    char *cmd_copy = strdup(input);
-                    char *first_token = strtok(cmd_copy, " \t\n");
-                    if (first_token) {
-                        char *cmd_name = strrchr(first_token, '/');
-                        cmd_name = cmd_name ? cmd_name + 1 : first_token;
-                        int job_id = add_stopped_job(pid, cmd_name);
-                        printf("[%d] Stopped %s\n", job_id, cmd_name);
-                    }
-                    free(cmd_copy);
-                }
-                
-                // Clear foreground process
-                clear_foreground_process();
-                
-                // Give terminal control back to shell
-                tcsetpgrp(STDIN_FILENO, getpgrp());
+                joblog_discard(out);
             }
+        } else {
+            // Execute built-in in current process
+            execute_builtin(stage, -1, -1);
         }
+        line_status = 0;
+        return;
+    }
+
+    // Resolve in the parent so a missing command never costs a spawn
+    const char *path = lookup_command_path(cmd->argv[0]);
+    if (!path) {
+        fprintf(stderr, "Command not found!\n");
+        line_status = 127;
+        return;
+    }
+
+    launch_opts_t opts;
+    launch_opts_init(&opts);
+    opts.stdin_fd = stage->in_fd;
+    opts.stdout_fd = stage->out_fd;
+    opts.foreground = !is_background;
+    opts.background = is_background;
+    apply_job_limits(&opts, prefix);
+    // joblog on: the shell keeps what a background job writes
+    job_output_t *out = is_background ? joblog_open(&opts.stderr_fd) : NULL;
+    if (out && opts.stdout_fd == -1) {
+        opts.stdout_fd = opts.stderr_fd;
+    }
+
+    struct timespec started; // wall time of the job, should it be stopped
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    pid_t pid;
+    int rc = launch_command(path, cmd->argv, &opts, &pid);
+    if (out) {
+        close(opts.stderr_fd);
+    }
+    if (rc != 0) {
+        joblog_discard(out);
+        fprintf(stderr, "Command not found!\n");
+        line_status = 127;
+        return;
+    }
+    arm_deadline(prefix, pid);
+
+    if (is_background) {
+        int job_id = add_background_job(pid, job_name(cmd));
+        adopt_prefix(job_id, prefix);
+        joblog_bind(out, job_id);
+        line_status = 0;
+        line_job_id = job_id;
+        return;
+    }
+
+    // Set as foreground process for signal handling
+    set_foreground_process(pid, pid);
+
+    // Wait for foreground process; the event loop keeps serving background jobs
+    int status;
+    if (loop_wait_foreground(&pid, 1, &status, NULL)) {
+        // Process was stopped (Ctrl-Z), move to background
+        const char *name = job_name(cmd);
+        int job_id = add_job_members(pid, &pid, &name, NULL, NULL, 1, JOB_STOPPED, &started);
+        adopt_prefix(job_id, prefix);
+        printf("[%d] Stopped %s\n", job_id, name);
+        line_status = 128 + SIGTSTP;
+        line_job_id = job_id;
     } else {
-        // Pipeline - validate redirections in each command first
-        char **cmds = NULL;
-        int ncmds = split_pipeline(input, &cmds);
-        if (ncmds <= 0) {
-            return;
-        }
-        
-        // Pre-validate ALL redirections in pipeline
-        int pipeline_has_errors = 0;
-        for (int i = 0; i < ncmds; i++) {
-            char *clean = NULL;
-            char *in_file = NULL;
-            char *out_file = NULL;
-            int out_append = 0;
-            int error_occurred = 0;
-            
-            extract_redirections(cmds[i], &clean, &in_file, &out_file, &out_append, &error_occurred);
-            
-            if (error_occurred) {
-                pipeline_has_errors = 1;
-            }
-            
-            free(clean); 
-            free(in_file); 
-            free(out_file);
+        line_status = exit_code(status);
+    }
+
+    // Clear foreground process
+    clear_foreground_process();
+
+    // Give terminal control back to shell
+    tcsetpgrp(STDIN_FILENO, getpgrp());
+}
+
+// Execute a cmd_group with a single atomic
+static void execute_simple_command(const atomic_t *cmd, int is_background, group_prefix_t *prefix) {
+    pipeline_stage_t stage = { cmd, find_intrinsic(cmd->argv[0]), -1, -1, 0 };
+
+    // Open redirections before running anything; errors stop the command
+    if (resolve_redirections(cmd, &stage.in_fd, &stage.out_fd) == -1) {
+        line_status = 1;
+        return;
+    }
+    run_simple_command(&stage, is_background, prefix);
+    close_stage_fds(&stage);
+}
+// ======================== LLM GENERATED CODE BEGINS =======================================
+// Run the stages of a pipeline whose redirections are already open
+static void run_pipeline(const pipeline_t *pipeline, pipeline_stage_t *stages, group_prefix_t *prefix);
+
+// Execute a cmd_group of two or more atomics connected by pipes
+static void execute_pipeline(const pipeline_t *pipeline, group_prefix_t *prefix) {
+    int ncmds = pipeline->nstages;
+
+    // Open ALL redirections in pipeline up front
+    pipeline_stage_t *stages = arena_calloc(&line_arena, (size_t)ncmds, sizeof(pipeline_stage_t));
+    if (!stages) {
+        perror("calloc");
+        return;
+    }
+    int pipeline_has_errors = 0;
+    int upstream_forkless = 0;
+    const atomic_t *cmd = pipeline->stages;
+    for (int i = 0; i < ncmds; i++, cmd = cmd->next) {
+        stages[i].cmd = cmd;
+        stages[i].builtin = find_intrinsic(cmd->argv[0]);
+        // A background pipeline never blocks the shell, so all its stages are spawned
+        stages[i].forkless = !pipeline->background && runs_forkless(&stages[i], upstream_forkless);
+        upstream_forkless |= stages[i].forkless;
+        if (stages[i].builtin && !stages[i].forkless && refuse_in_child(&stages[i])) {
+            pipeline_has_errors = 1;
         }
-        
-        if (pipeline_has_errors) {
-            free_pipeline(cmds, ncmds);
-            return;
+        if (resolve_redirections(cmd, &stages[i].in_fd, &stages[i].out_fd) == -1) {
+            pipeline_has_errors = 1;
         }
-        
-        pid_t pipeline_pgid = 0;
-        
-        if (is_background) {
-            // For background pipelines, fork once and run entire pipeline in background
-            pid_t main_pid = fork();
-            if (main_pid == -1) {
-                perror("fork");
-                free_pipeline(cmds, ncmds);
-                return;
-            } else if (main_pid == 0) {
-                // Child: create new process group and redirect stdin from /dev/null
-                setpgid(0, 0);
-                freopen("/dev/null", "r", stdin);
-                // Continue with pipeline execution below
-                pipeline_pgid = getpid();
-            } else {
-                // Parent: add to background jobs and return
-                setpgid(main_pid, main_pid);
-                char *cmd_copy = strdup(input);
-                char *first_token = strtok(cmd_copy, " \t\n|");
-                if (first_token) {
-                    char *cmd_name = strrchr(first_token, '/');
-                    cmd_name = cmd_name ? cmd_name + 1 : first_token;
-                    add_background_job(main_pid, cmd_name);
-                }
-                free(cmd_copy);
-                free_pipeline(cmds, ncmds);
-                return;
+    }
+
+    if (!pipeline_has_errors) {
+        run_pipeline(pipeline, stages, prefix);
+    } else {
+        line_status = 1;
+    }
+    for (int i = 0; i < ncmds; i++) {
+        close_stage_fds(&stages[i]);
+    }
+}
+
+static void run_pipeline(const pipeline_t *pipeline, pipeline_stage_t *stages, group_prefix_t *prefix) {
+    int ncmds = pipeline->nstages;
+    int is_background = pipeline->background;
+
+    // Background or not, the shell spawns every stage itself into one
+    // process group; the job it records owns all of them
+    pid_t pipeline_pgid = 0;
+
+    int pipes_needed = ncmds - 1;
+
+    // Dynamically allocate pipe file descriptors
+    int (*pipefd)[2] = arena_alloc(&line_arena, pipes_needed * sizeof(int[2]));
+    if (!pipefd) {
+        perror("malloc");
+        return;
+    }
+
+    // Create all pipes
+    for (int i = 0; i < pipes_needed; ++i) {
+        if (pipe(pipefd[i]) == -1) {
+            perror("pipe");
+            // Close any pipes we've already created
+            for (int j = 0; j < i; j++) {
+                close(pipefd[j][0]);
+                close(pipefd[j][1]);
             }
-        }
-        
-        int pipes_needed = ncmds - 1;
-        
-        // Dynamically allocate pipe file descriptors
-        int (*pipefd)[2] = malloc(pipes_needed * sizeof(int[2]));
-        if (!pipefd) {
-            perror("malloc");
-            free_pipeline(cmds, ncmds);
-            if (is_background) exit(EXIT_FAILURE);
             return;
         }
-        
-        // Create all pipes
-        for (int i = 0; i < pipes_needed; ++i) {
-            if (pipe(pipefd[i]) == -1) {
-                perror("pipe");
-                // Close any pipes we've already created
-                for (int j = 0; j < i; j++) {
-                    close(pipefd[j][0]);
-                    close(pipefd[j][1]);
-                }
-                free(pipefd);
-                free_pipeline(cmds, ncmds);
-                if (is_background) exit(EXIT_FAILURE);
-                return;
-            }
+        // Spawned stages must not inherit the other stages' pipe ends
+        fcntl(pipefd[i][0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipefd[i][1], F_SETFD, FD_CLOEXEC);
+    }
+
+    // Dynamically allocate process IDs, stage names, exit statuses and usage
+    pid_t *pids = arena_alloc(&line_arena, ncmds * sizeof(pid_t));
+    const char **names = arena_alloc(&line_arena, ncmds * sizeof(char *));
+    int *statuses = arena_alloc(&line_arena, ncmds * sizeof(int));
+    struct rusage *usages = arena_alloc(&line_arena, ncmds * sizeof(struct rusage));
+    if (!pids || !names || !statuses || !usages) {
+        perror("malloc");
+        for (int i = 0; i < pipes_needed; i++) {
+            close(pipefd[i][0]);
+            close(pipefd[i][1]);
         }
+        return;
+    }
 
-        // Dynamically allocate process IDs array
-        pid_t *pids = malloc(ncmds * sizeof(pid_t));
-        if (!pids) {
-            perror("malloc");
-            for (int i = 0; i < pipes_needed; i++) {
-                close(pipefd[i][0]);
-                close(pipefd[i][1]);
-            }
-            free(pipefd);
-            free_pipeline(cmds, ncmds);
-            if (is_background) exit(EXIT_FAILURE);
-            return;
+    // joblog on: the shell keeps what a background pipeline writes (all of
+    // its stderr, and the last stage's stdout)
+    int capture_fd = -1;
+    job_output_t *out = is_background ? joblog_open(&capture_fd) : NULL;
+
+    // Spawn each stage; forkless built-ins run afterwards, once their readers exist
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    int spawned = 0;
+    for (int i = 0; i < ncmds; ++i) {
+        names[i] = job_name(stages[i].cmd);
+        if (stages[i].forkless) {
+            pids[i] = 0;
+            continue;
+        }
+        launch_opts_t opts;
+        launch_opts_init(&opts);
+        opts.pgid = pipeline_pgid; // 0 for the first stage -> leads the group
+        opts.foreground = !is_background && pipeline_pgid == 0;
+        opts.background = is_background;
+        apply_job_limits(&opts, prefix);
+        // Pipes connect stages unless overridden by an explicit '<' / '>'
+        if (i > 0) opts.stdin_fd = pipefd[i-1][0];
+        if (i < ncmds - 1) opts.stdout_fd = pipefd[i][1];
+        if (stages[i].in_fd != -1) opts.stdin_fd = stages[i].in_fd;
+        if (stages[i].out_fd != -1) opts.stdout_fd = stages[i].out_fd;
+        if (out) {
+            opts.stderr_fd = capture_fd;
+            if (opts.stdout_fd == -1) opts.stdout_fd = capture_fd;
         }
 
-        // Fork and execute each command in the pipeline
-        for (int i = 0; i < ncmds; ++i) {
-            pids[i] = fork();
+        pids[i] = 0; // Mark as invalid until something runs
+        if (stages[i].builtin) {
+            pids[i] = launch_fork(&opts);
             if (pids[i] == -1) {
-                perror("fork");
-                pids[i] = 0; // Mark as invalid for cleanup
+                pids[i] = 0;
                 continue;
             }
             if (pids[i] == 0) {
-                // child i
-                
-                // Set process group (all processes in pipeline share same pgid)
-                if (i == 0) {
-                    setpgid(0, 0);
-                    pipeline_pgid = getpid();
-                } else {
-                    setpgid(0, pipeline_pgid);
-                }
-                
-                // Give terminal control to foreground pipeline (if not background)
-                if (!is_background && i == 0) {
-                    tcsetpgrp(STDIN_FILENO, pipeline_pgid);
-                }
-                
-                // Connect input from previous pipe unless overridden later by explicit '<'
-                if (i > 0) {
-                    if (dup2(pipefd[i-1][0], STDIN_FILENO) == -1) {
-                        perror("dup2");
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                // Connect output to next pipe unless overridden later by explicit '>'
-                if (i < ncmds - 1) {
-                    if (dup2(pipefd[i][1], STDOUT_FILENO) == -1) {
-                        perror("dup2");
-                        exit(EXIT_FAILURE);
-                    }
-                }
-                // Close all pipe fds in child before applying file redirections
+                // child i: close all pipe fds before applying file redirections
                 for (int k = 0; k < pipes_needed; ++k) {
                     close(pipefd[k][0]);
                     close(pipefd[k][1]);
                 }
-                // Now parse and apply per-command redirections which override pipes if present
-                exec_single_command(cmds[i]);
-                // If exec_single_command were to return, treat as failure
+                exec_single_command(&stages[i]);
+                // never returns
+            }
+        } else {
+            const char *path = lookup_command_path(stages[i].cmd->argv[0]);
+            if (!path || launch_command(path, stages[i].cmd->argv, &opts, &pids[i]) != 0) {
                 fprintf(stderr, "Command not found!\n");
-                _exit(127);
-            } else {
-                // Parent: set process group for each child
-                if (i == 0) {
-                    pipeline_pgid = pids[i];
-                    setpgid(pids[i], pids[i]);
-                } else {
-                    setpgid(pids[i], pipeline_pgid);
-                }
+                pids[i] = 0;
+                continue;
             }
         }
-        
-        // Parent (or background process parent): close all pipe fds
-        for (int k = 0; k < pipes_needed; ++k) {
+        if (pipeline_pgid == 0) {
+            pipeline_pgid = pids[i];
+        }
+        spawned++;
+    }
+
+    arm_deadline(prefix, pipeline_pgid);
+    if (out) {
+        close(capture_fd);
+    }
+
+    // Parent: close all pipe fds except the write ends forkless stages
+    // still need and the read ends of forkless stdin readers
+    for (int k = 0; k < pipes_needed; ++k) {
+        if (!reads_pipe_forkless(&stages[k + 1])) {
             close(pipefd[k][0]);
+        }
+        if (!stages[k].forkless) {
             close(pipefd[k][1]);
         }
-        
-        if (!is_background) {
-            // Set pipeline as foreground for signal handling
-            set_foreground_process(pids[0], pipeline_pgid);
+    }
+
+    if (!is_background && pipeline_pgid > 0) {
+        // Set pipeline as foreground for signal handling
+        set_foreground_process(pipeline_pgid, pipeline_pgid);
+        // Forkless stages may run the loop: the spawned ones must be ours by then
+        loop_expect_foreground(pids, ncmds, statuses, usages);
+    }
+
+    // Run forkless built-ins last to first: every reader of their output is
+    // then either a spawned stage or already finished (its read end is closed,
+    // so writes fail with EPIPE), and a full pipe can never stall the shell
+    for (int i = ncmds - 1; i >= 0; --i) {
+        if (!stages[i].forkless) {
+            continue;
         }
-        
-        // Wait for pipeline processes correctly
-        if (!is_background) {
-            int pipeline_stopped = 0;
-            int processes_remaining = ncmds;
-            
-            while (processes_remaining > 0 && !pipeline_stopped) {
-                int status;
-                pid_t result = waitpid(-pipeline_pgid, &status, WUNTRACED);
-                
-                if (result > 0) {
-                    if (WIFSTOPPED(status)) {
-                        // Entire pipeline was stopped
-                        pipeline_stopped = 1;
-                        char *cmd_copy = strdup(input);
-                        char *first_token = strtok(cmd_copy, " \t\n|");
-                        if (first_token) {
-                            char *cmd_name = strrchr(first_token, '/');
-                            cmd_name = cmd_name ? cmd_name + 1 : first_token;
-                            int job_id = add_stopped_job(pipeline_pgid, cmd_name);
-                            printf("[%d] Stopped %s\n", job_id, cmd_name);
-                        }
-                        free(cmd_copy);
-                        break;
-                    } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-                        // A process in the pipeline finished
-                        processes_remaining--;
-                    }
-                } else if (result == -1 && errno == ECHILD) {
-                    // No more children to wait for
-                    break;
-                }
-            }
-        } else {
-            // For background processes, don't wait
-            // They'll be reaped by check_background_processes()
+        int in_fd = i > 0 && reads_pipe_forkless(&stages[i]) ? pipefd[i-1][0] : -1;
+        int out_fd = i < ncmds - 1 ? pipefd[i][1] : -1;
+        execute_builtin(&stages[i], in_fd, out_fd);
+        if (in_fd != -1) {
+            close(in_fd);
         }
-        
-        // Clear foreground process and give terminal back to shell
-        if (!is_background) {
-            clear_foreground_process();
-            tcsetpgrp(STDIN_FILENO, getpgrp());
+        if (out_fd != -1) {
+            close(out_fd); // the next stage sees EOF
         }
-        
-        // Cleanup
-        free(pipefd);
-        free(pids);
-        free_pipeline(cmds, ncmds);
-        
-        // If this was a background pipeline, exit the background process
-        if (is_background) {
-            exit(EXIT_SUCCESS);
+    }
+
+    if (is_background) {
+        // Its stages are reaped by the event loop as they finish
+        if (spawned > 0) {
+            int job_id = add_job_members(pipeline_pgid, pids, names, NULL, NULL, ncmds,
+                                         JOB_RUNNING, &started);
+            adopt_prefix(job_id, prefix);
+            joblog_bind(out, job_id);
+            line_job_id = job_id;
+        } else {
+            joblog_discard(out);
         }
+        line_status = 0;
+        return;
+    }
+
+    // Wait for pipeline processes correctly
+    if (spawned > 0 && loop_wait_foreground(pids, ncmds, statuses, usages)) {
+        // Pipeline was stopped: the stages that already finished keep their status and usage
+        int job_id = add_job_members(pipeline_pgid, pids, names, statuses, usages, ncmds,
+                                     JOB_STOPPED, &started);
+        adopt_prefix(job_id, prefix);
+        printf("[%d] Stopped %s\n", job_id, job_name(pipeline->stages));
+        line_status = 128 + SIGTSTP;
+        line_job_id = job_id;
+    } else if (pids[ncmds - 1] > 0) {
+        line_status = exit_code(statuses[ncmds - 1]); // like $?: the last stage's
+    } else {
+        line_status = stages[ncmds - 1].forkless ? 0 : 127;
     }
+
+    // Clear foreground process and give terminal back to shell
+    clear_foreground_process();
+    tcsetpgrp(STDIN_FILENO, getpgrp());
 }
 
 // ==================================== LLM GENERATED CODE ENDS ===================================================
 
+// The cmd_group without the first skip words of its first atomic (in line_arena)
+static const pipeline_t *skip_words(const pipeline_t *p, int skip) {
+    pipeline_t *stripped = arena_alloc(&line_arena, sizeof(pipeline_t));
+    atomic_t *cmd = arena_alloc(&line_arena, sizeof(atomic_t));
+    if (!stripped || !cmd) {
+        perror("malloc");
+        return NULL;
+    }
+    *stripped = *p;
+    *cmd = *p->stages;
+    cmd->argc -= skip;
+    cmd->argv += skip;
+    stripped->stages = cmd;
+    return stripped;
+}
+
+// Parse the limit / timeout prefixes (in any order) off the front of a
+// cmd_group into prefix. Returns the cmd_group left to run, NULL if it cannot run
+static const pipeline_t *strip_prefixes(const pipeline_t *p, group_prefix_t *prefix) {
+    const intrinsic_t *builtin;
+    const char *first_prefix = NULL;
+    int timed = 0;
+
+    while (p && (builtin = find_intrinsic(p->stages->argv[0])) &&
+           (builtin->flags & INTRINSIC_PREFIX)) {
+        const atomic_t *cmd = p->stages;
+        int skip = -1;
+        if (strcmp(builtin->name, "limit") == 0 && !prefix->limited) {
+            skip = parse_limits(cmd->argc, cmd->argv, &prefix->limits);
+            prefix->limited = skip != -1;
+        } else if (strcmp(builtin->name, "timeout") == 0 && !timed) {
+            skip = parse_timeout(cmd->argc, cmd->argv, &prefix->timeout_ms, &prefix->grace_ms);
+            timed = skip != -1;
+        } else {
+            fprintf(stderr, "%s: given twice\n", builtin->name);
+        }
+        if (!first_prefix) {
+            first_prefix = builtin->name;
+        }
+        p = skip == -1 ? NULL : skip_words(p, skip);
+    }
+    if (!p) {
+        return NULL;
+    }
+
+    // Built-ins run inside the shell, out of reach of any limit or signal
+    for (const atomic_t *a = p->stages; a; a = a->next) {
+        if (find_intrinsic(a->argv[0])) {
+            fprintf(stderr, "%s: %s is a built-in\n", first_prefix, a->argv[0]);
+            return NULL;
+        }
+    }
+    if (prefix->limited) {
+        prefix->limits.cgroup = cgroup_create(&prefix->limits);
+    }
+    return p;
+}
+
+// Run one cmd_group, in the foreground or background as marked
+static void run_cmd_group(const pipeline_t *p) {
+    group_prefix_t group_prefix;
+    group_prefix_t *prefix = NULL;
+    const intrinsic_t *builtin = find_intrinsic(p->stages->argv[0]);
+    if (builtin && (builtin->flags & INTRINSIC_PREFIX)) {
+        memset(&group_prefix, 0, sizeof(group_prefix));
+        if (!(p = strip_prefixes(p, &group_prefix))) {
+            line_status = 2;
+            return;
+        }
+        prefix = &group_prefix;
+    }
+
+    if (p->nstages == 1) {
+        execute_simple_command(p->stages, p->background, prefix);
+    } else {
+        execute_pipeline(p, prefix);
+    }
+
+    // Still ours unless a job took them over: the foreground run is over
+    if (prefix) {
+        if (watchdog_expired(prefix->watchdog)) {
+            char why[64];
+            format_timeout(prefix->watchdog, why, sizeof(why));
+            fprintf(stderr, "%s: %s\n", job_name(p->stages), why);
+        }
+        watchdog_release(prefix->watchdog);
+        cgroup_release(prefix->limits.cgroup);
+    }
+}
+
+// A background cmd_group waiting for a job slot (see queue_job). The line's
+// AST is gone by the time it starts, so it keeps a private copy, along with
+// the directory it was typed in
+typedef struct {
+    arena_t arena;
+    pipeline_t *pipeline;
+    char *cwd;
+} queued_group_t;
+
+static char *arena_strdup(arena_t *arena, const char *s) {
+    return arena_strndup(arena, s, strlen(s));
+}
+
+// Deep copy of one cmd_group (stages, argv, redirections) into arena
+static pipeline_t *copy_pipeline(const pipeline_t *src, arena_t *arena) {
+    pipeline_t *copy = arena_calloc(arena, 1, sizeof(pipeline_t));
+    if (!copy) return NULL;
+    copy->nstages = src->nstages;
+    copy->background = src->background;
+
+    atomic_t **tail = &copy->stages;
+    for (const atomic_t *a = src->stages; a; a = a->next) {
+        atomic_t *stage = arena_calloc(arena, 1, sizeof(atomic_t));
+        char **argv = stage ? arena_calloc(arena, (size_t)a->argc + 1, sizeof(char *)) : NULL;
+        if (!argv) return NULL;
+        stage->argc = a->argc;
+        stage->argv = argv;
+        for (int i = 0; i < a->argc; i++) {
+            if (!(argv[i] = arena_strdup(arena, a->argv[i]))) return NULL;
+        }
+
+        redirect_t **rtail = &stage->redirects;
+        for (const redirect_t *r = a->redirects; r; r = r->next) {
+            redirect_t *redir = arena_calloc(arena, 1, sizeof(redirect_t));
+            if (!redir || !(redir->target = arena_strdup(arena, r->target))) return NULL;
+            redir->type = r->type;
+            *rtail = redir;
+            rtail = &redir->next;
+        }
+        *tail = stage;
+        tail = &stage->next;
+    }
+    return copy;
+}
+
+// job_launch_fn of queued cmd_groups: run it from the directory it was queued
+// in (the shell's own cwd is put back afterwards), then free the copy
+static void launch_queued_group(void *arg, int run) {
+    queued_group_t *queued = arg;
+
+    if (run != JOB_LAUNCH_DROP) {
+        queued->pipeline->background = run == JOB_LAUNCH_BACKGROUND;
+        int here = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (here == -1 || chdir(queued->cwd) == -1) {
+            fprintf(stderr, "%s: %s\n", queued->cwd, strerror(errno));
+        } else {
+            // May be admitted in the middle of another line: keep its part of
+            // the arena, and its status for history
+            arena_mark_t mark = arena_mark(&line_arena);
+            int status = line_status, job_id = line_job_id;
+            run_cmd_group(queued->pipeline);
+            line_status = status;
+            line_job_id = job_id;
+            arena_release(&line_arena, mark);
+            if (fchdir(here) == -1) {
+                perror("fchdir");
+            }
+        }
+        if (here != -1) {
+            close(here);
+        }
+    }
+    arena_destroy(&queued->arena);
+    free(queued);
+}
+
+// All job slots are taken: hold a background cmd_group until one frees up
+static void queue_cmd_group(const pipeline_t *p) {
+    char cwd[PATH_MAX];
+    queued_group_t *queued = malloc(sizeof(queued_group_t));
+    if (!queued) {
+        perror("malloc");
+        return;
+    }
+    arena_init(&queued->arena, QUEUED_ARENA_BLOCK);
+    queued->pipeline = copy_pipeline(p, &queued->arena);
+    queued->cwd = getcwd(cwd, sizeof(cwd)) ? arena_strdup(&queued->arena, cwd) : NULL;
+    int job_id = -1;
+    if (!queued->pipeline || !queued->cwd ||
+        (job_id = queue_job(job_name(p->stages), launch_queued_group, queued)) == -1) {
+        perror("queue_job");
+        launch_queued_group(queued, JOB_LAUNCH_DROP);
+        return;
+    }
+    line_status = 0;
+    line_job_id = job_id;
+}
+
+// Parse the line once and walk its AST. Returns 0 (running nothing) on invalid syntax.
 int execute_command(const char *input) {
     if (!input || strlen(input) == 0) {
         return 0;
     }
 
+    // Roll back to here when done; nested calls (log execute) only drop their own part
+    arena_mark_t mark = arena_mark(&line_arena);
+    // Reuse the plan of a line seen before, parse (once) otherwise
+    plan_entry_t *plan = NULL;
+    const shell_ast_t *ast = plan_acquire(input, &line_arena, &plan);
+    if (!ast) {
+        arena_release(&line_arena, mark);
+        return 0;
+    }
+
     // Check if command contains 'log' anywhere - if so, don't add to history
-    int should_add_to_history = !contains_log_command(input);
-
-    // Check for command separators (semicolons or ampersands)
-    if (strchr(input, ';') != NULL || strchr(input, '&') != NULL) {
-        // Split by separators and handle background flags per command
-        char **seq_cmds = NULL;
-        int *bg_flags = NULL;
-        int nseq = split_sequential_with_bg(input, &seq_cmds, &bg_flags);
-        
-        for (int i = 0; i < nseq; i++) {
-            if (seq_cmds[i] && strlen(seq_cmds[i]) > 0) {
-                execute_single_shell_command(seq_cmds[i], bg_flags[i]);
-            }
+    int should_add_to_history = !contains_log_command(ast);
+    char cwd[PATH_MAX];
+    struct timespec wall, started, finished;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    history_entry_t entry = { (long long)wall.tv_sec * 1000000 + wall.tv_nsec / 1000, 0, 0, 0,
+                              NULL, 0, getcwd(cwd, sizeof(cwd)), 0 };
+    entry.cwd_len = entry.cwd ? strlen(entry.cwd) : 0;
+    line_status = 0;
+    line_job_id = 0;
+
+    // cmd_groups run in order, each in the foreground or background as marked;
+    // background ones wait in the job queue while every slot is taken
+    for (const pipeline_t *p = ast->pipelines; p; p = p->next) {
+        if (p->background && !job_slot_available()) {
+            queue_cmd_group(p);
+        } else {
+            run_cmd_group(p);
         }
-        
-        free_sequential_with_bg(seq_cmds, bg_flags, nseq);
-    } else {
-        // Single command with no separators (may contain pipes)
-        execute_single_shell_command(input, 0);
     }
 
     // Add entire command line to history only if it doesn't contain 'log'
     if (should_add_to_history) {
-        add_to_history(input);
+        clock_gettime(CLOCK_MONOTONIC, &finished);
+        entry.duration_ms = (unsigned long)((finished.tv_sec - started.tv_sec) * 1000 +
+                                            (finished.tv_nsec - started.tv_nsec) / 1000000);
+        entry.status = line_status;
+        entry.job_id = line_job_id;
+        add_to_history(input, &entry);
     }
-    
+
+    plan_release(plan);
+    arena_release(&line_arena, mark);
     return 1;
-}
\ No newline at end of file
+}
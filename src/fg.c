@@ -1,4 +1,5 @@
 #include "shell.h"
+#include "bg_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,26 +10,17 @@ void fg(int argc, char **argv) {
     
     if (argc == 1) {
         // No job number provided, use most recent job req 4
-        extern int get_most_recent_job(void);
-        int job_index = get_most_recent_job();
+        bg_job_t *job = get_most_recent_job();
         
-        if (job_index == -1) {
+        if (!job) {
             printf("No background jobs\n");
             return;
         }
         
-        // Get job info for display
-        extern void get_job_info(int index, pid_t *pid, char *command, int *status);
-        pid_t pid;
-        char command[256];
-        int status;
-        get_job_info(job_index, &pid, command, &status);
-        
-        printf("%s\n", command);
+        printf("%s\n", job->command);
         
         // Bring job to foreground
-        extern void bring_job_to_foreground(int job_index);
-        bring_job_to_foreground(job_index);
+        bring_job_to_foreground(job);
         
     } else if (argc == 2) {
         // Job number provided
@@ -41,28 +33,19 @@ void fg(int argc, char **argv) {
         }
         
         // Find job by number
-        extern int find_job_by_number(int job_number);
-        int job_index = find_job_by_number(job_number);
+        bg_job_t *job = find_job_by_number(job_number);
         
-        if (job_index == -1) {
+        if (!job) {
             printf("No such job\n");
             return;
         }
         
-        // Get job info for display
-        extern void get_job_info(int index, pid_t *pid, char *command, int *status);
-        pid_t pid;
-        char command[256];
-        int status;
-        get_job_info(job_index, &pid, command, &status);
-        
-        printf("%s\n", command);
+        printf("%s\n", job->command);
         
         // Bring job to foreground
-        extern void bring_job_to_foreground(int job_index);
-        bring_job_to_foreground(job_index);
+        bring_job_to_foreground(job);
         
     } else {
         printf("Usage: fg [job_number]\n");
     }
-} 
\ No newline at end of file
+} 
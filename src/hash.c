@@ -0,0 +1,229 @@
+#include "shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// table of command name -> absolute path, so PATH is walked once per command
+// instead of once per execution (execvp tries every PATH entry every time)
+
+#define HASH_BUCKETS 64
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+typedef struct path_entry {
+    char *name;
+    char *path;
+    int dir_index;    // position of the directory in PATH it was found in
+    unsigned hits;
+    struct path_entry *next;
+} path_entry_t;
+
+typedef struct {
+    char *dir;
+    struct timespec mtime; // directory mtime when last checked
+    int valid;             // 0 if the directory could not be stat'd
+} path_dir_t;
+
+static path_entry_t *buckets[HASH_BUCKETS];
+static path_dir_t *path_dirs = NULL;
+static int path_dir_count = 0;
+static char *cached_path_env = NULL; // PATH value the table was built for
+
+static unsigned hash_name(const char *name) {
+    unsigned h = 2166136261u; // FNV-1a
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h % HASH_BUCKETS;
+}
+
+static void snapshot_dir(path_dir_t *d) {
+    struct stat st;
+    if (stat(d->dir[0] ? d->dir : ".", &st) == 0) {
+        d->mtime = st.st_mtim;
+        d->valid = 1;
+    } else {
+        d->valid = 0;
+    }
+}
+
+// Drop every entry found in directory min_index or later
+static void flush_entries(int min_index) {
+    for (int b = 0; b < HASH_BUCKETS; b++) {
+        path_entry_t **pp = &buckets[b];
+        while (*pp) {
+            path_entry_t *e = *pp;
+            if (e->dir_index >= min_index) {
+                *pp = e->next;
+                free(e->name);
+                free(e->path);
+                free(e);
+            } else {
+                pp = &e->next;
+            }
+        }
+    }
+}
+
+// Rebuild the directory list if PATH changed since the table was built
+static void sync_path(void) {
+    const char *path = getenv("PATH");
+    if (!path) path = DEFAULT_PATH;
+    if (cached_path_env && strcmp(cached_path_env, path) == 0) {
+        return;
+    }
+
+    flush_entries(0);
+    for (int i = 0; i < path_dir_count; i++) {
+        free(path_dirs[i].dir);
+    }
+    free(path_dirs);
+    free(cached_path_env);
+
+    cached_path_env = strdup(path);
+    path_dir_count = 1;
+    for (const char *p = path; *p; p++) {
+        if (*p == ':') path_dir_count++;
+    }
+    path_dirs = calloc((size_t)path_dir_count, sizeof(path_dir_t));
+
+    const char *start = path;
+    for (int i = 0; i < path_dir_count; i++) {
+        const char *end = strchr(start, ':');
+        size_t len = end ? (size_t)(end - start) : strlen(start);
+        path_dirs[i].dir = strndup(start, len);
+        snapshot_dir(&path_dirs[i]);
+        start = end ? end + 1 : start + len;
+    }
+}
+
+// An entry stays valid while no directory up to and including its own changed:
+// a change earlier in PATH may shadow it, a change in its own may remove it
+static int entry_still_valid(const path_entry_t *e) {
+    for (int i = 0; i <= e->dir_index && i < path_dir_count; i++) {
+        path_dir_t now = path_dirs[i];
+        snapshot_dir(&now);
+        if (now.valid != path_dirs[i].valid ||
+            now.mtime.tv_sec != path_dirs[i].mtime.tv_sec ||
+            now.mtime.tv_nsec != path_dirs[i].mtime.tv_nsec) {
+            flush_entries(i);
+            path_dirs[i] = now;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_executable_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Resolve a command name to the path to execute, or NULL if it is not found.
+// Names containing '/' are used as-is; names found in a relative PATH entry
+// are not remembered since they depend on the current directory.
+const char *lookup_command_path(const char *name) {
+    static char uncached[PATH_MAX];
+
+    if (!name || !*name) return NULL;
+    if (strchr(name, '/')) {
+        return is_executable_file(name) ? name : NULL;
+    }
+
+    sync_path();
+    unsigned b = hash_name(name);
+    for (path_entry_t *e = buckets[b]; e; e = e->next) {
+        if (strcmp(e->name, name) == 0) {
+            if (!entry_still_valid(e)) break; // e was freed
+            e->hits++;
+            return e->path;
+        }
+    }
+
+    for (int i = 0; i < path_dir_count; i++) {
+        const char *dir = path_dirs[i].dir[0] ? path_dirs[i].dir : ".";
+        char candidate[PATH_MAX];
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", dir, name) >= (int)sizeof(candidate)) {
+            continue;
+        }
+        if (!is_executable_file(candidate)) {
+            continue;
+        }
+        if (dir[0] != '/') {
+            strcpy(uncached, candidate);
+            return uncached;
+        }
+
+        path_entry_t *e = malloc(sizeof(path_entry_t));
+        e->name = strdup(name);
+        e->path = strdup(candidate);
+        e->dir_index = i;
+        e->hits = 1;
+        e->next = buckets[b];
+        buckets[b] = e;
+        return e->path;
+    }
+    return NULL;
+}
+
+static void forget_command(const char *name) {
+    path_entry_t **pp = &buckets[hash_name(name)];
+    while (*pp) {
+        path_entry_t *e = *pp;
+        if (strcmp(e->name, name) == 0) {
+            *pp = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            return;
+        }
+        pp = &e->next;
+    }
+}
+
+static void print_table(void) {
+    int printed = 0;
+    for (int b = 0; b < HASH_BUCKETS; b++) {
+        for (path_entry_t *e = buckets[b]; e; e = e->next) {
+            if (!printed) printf("hits\tcommand\n");
+            printf("%4u\t%s\n", e->hits, e->path);
+            printed = 1;
+        }
+    }
+    if (!printed) {
+        printf("hash: hash table empty\n");
+    }
+    fflush(stdout);
+}
+
+// hash            list remembered commands
+// hash -r         forget everything (rehash on next use)
+// hash -d name... forget the given commands
+// hash name...    look the given commands up again now
+void hash_command(int argc, char **argv) {
+    if (argc == 1) {
+        sync_path();
+        print_table();
+    } else if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+        flush_entries(0);
+    } else if (strcmp(argv[1], "-d") == 0) {
+        if (argc == 2) {
+            fprintf(stderr, "Usage: hash [-r] [-d name...] [name...]\n");
+            return;
+        }
+        for (int i = 2; i < argc; i++) {
+            forget_command(argv[i]);
+        }
+    } else if (argv[1][0] == '-') {
+        fprintf(stderr, "Usage: hash [-r] [-d name...] [name...]\n");
+    } else {
+        for (int i = 1; i < argc; i++) {
+            forget_command(argv[i]);
+            if (!lookup_command_path(argv[i])) {
+                fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            }
+        }
+    }
+}
@@ -0,0 +1,593 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include "history.h"
+#include "trigram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Journal: a magic line, then binary records (record_header_t, the command,
+// the cwd, a '\n'), only ever appended to (one O_APPEND write per batch, see
+// history_flush), except by compaction. A journal from before records had
+// fields (plain lines) is converted when it is first opened.
+// Index: a header naming the journal it belongs to (by inode), then one
+// uint64 journal offset per record. Record n is the one at offsets[n].
+//
+// Compaction keeps the newest HISTORY_MAX records once COMPACT_SLACK more have
+// piled up. Both files are rewritten into temporaries that are renamed over
+// the originals, the journal first; an index left behind by a crash between
+// the renames names the wrong inode and is rebuilt. So are an index that
+// points past the journal and records the index has not caught up with yet,
+// which only takes a scan of the journal's tail. A record torn by a crash
+// mid-append fails that scan and is cut off.
+//
+// Every shell started in the same directory shares the files. Anything that
+// writes them (append, repair, compaction, purge) holds an flock on a
+// separate lock file, since the journal and index themselves are replaced by
+// compaction. Readers take no lock: an index entry is only written after the
+// record it points to, so whatever part of the index is visible is valid.
+// Before log reads anything, history_sync picks up what sibling sessions
+// have appended since, from the sizes of the two files alone, and reopens
+// both if the journal was compacted or purged under it.
+//
+// log search goes through a trigram index of the commands (see trigram.c),
+// kept in .shell_history.tri and updated along with every append.
+
+#define HISTORY_MAX 500000
+#define COMPACT_SLACK (HISTORY_MAX / 4)
+#define PENDING_SIZE (4 * (MAX_INPUT_SIZE + PATH_MAX))
+#define PENDING_RECORDS 64
+#define SCAN_CHUNK (256 * 1024)  // more than the largest possible record
+#define RECORD_MAGIC 0x52484853u // "SHHR"
+
+static const char journal_magic[8] = "SHHIST2\n";
+static const char index_magic[8] = "SHIDX2\n";
+
+// On-disk record header, in the host's byte order
+typedef struct {
+    uint32_t magic;
+    uint16_t command_len;
+    uint16_t cwd_len;
+    int32_t status;
+    int32_t job_id;
+    int64_t start_us;
+    uint32_t duration_ms;
+    uint32_t reserved;
+} record_header_t;
+
+typedef struct {
+    char magic[8];
+    uint64_t journal_ino;
+} index_header_t;
+
+static char journal_path[PATH_MAX];
+static char index_path[PATH_MAX + 8];
+static char lock_path[PATH_MAX + 8];
+static char trigram_path[PATH_MAX + 8];
+static int lock_fd = -1;                // opened on first use
+static int journal_fd = -1;             // O_APPEND; -1 until the journal exists
+static int index_fd = -1;
+static uint64_t journal_size = 0;
+static long records = 0;
+
+static const char *journal_map = NULL;  // [0, journal_mapped) of the journal
+static size_t journal_mapped = 0;
+static const uint64_t *offsets = NULL;  // index entries, records_mapped of them
+static size_t index_mapped = 0;         // bytes, header included
+static long records_mapped = 0;
+
+static char pending[PENDING_SIZE];      // records not written yet
+static size_t pending_len = 0;
+static uint64_t pending_at[PENDING_RECORDS]; // their offsets within pending
+static int pending_records = 0;
+
+static void unmap_files(void) {
+    if (journal_map) munmap((void *)journal_map, journal_mapped);
+    if (offsets) munmap((void *)((const char *)offsets - sizeof(index_header_t)), index_mapped);
+    journal_map = NULL;
+    offsets = NULL;
+    journal_mapped = index_mapped = 0;
+    records_mapped = 0;
+}
+
+static void close_files(void) {
+    unmap_files();
+    if (journal_fd != -1) close(journal_fd);
+    if (index_fd != -1) close(index_fd);
+    journal_fd = index_fd = -1;
+    journal_size = 0;
+    records = 0;
+}
+
+// Map both files as far as they have been written. Returns -1 if they cannot be
+static int map_files(void) {
+    if (journal_mapped == journal_size && records_mapped == records) {
+        return 0;
+    }
+    unmap_files();
+    if (records == 0) {
+        return 0;
+    }
+    void *j = mmap(NULL, (size_t)journal_size, PROT_READ, MAP_SHARED, journal_fd, 0);
+    size_t isize = sizeof(index_header_t) + (size_t)records * sizeof(uint64_t);
+    void *i = mmap(NULL, isize, PROT_READ, MAP_SHARED, index_fd, 0);
+    if (j == MAP_FAILED || i == MAP_FAILED) {
+        if (j != MAP_FAILED) munmap(j, (size_t)journal_size);
+        if (i != MAP_FAILED) munmap(i, isize);
+        return -1;
+    }
+    journal_map = j;
+    journal_mapped = (size_t)journal_size;
+    offsets = (const uint64_t *)((char *)i + sizeof(index_header_t));
+    index_mapped = isize;
+    records_mapped = records;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Length of the complete, well-formed record at the start of buf (avail
+// bytes), or 0 if there is none
+static size_t record_length(const char *buf, size_t avail, record_header_t *header) {
+    if (avail < sizeof(record_header_t)) {
+        return 0;
+    }
+    memcpy(header, buf, sizeof(record_header_t));
+    size_t len = sizeof(record_header_t) + header->command_len + header->cwd_len + 1;
+    if (header->magic != RECORD_MAGIC || len > avail || buf[len - 1] != '\n') {
+        return 0;
+    }
+    return len;
+}
+
+// Write the record for entry into buf (size bytes free). Returns its length,
+// 0 if it does not fit
+static size_t encode_record(char *buf, size_t size, const history_entry_t *entry) {
+    size_t command_len = entry->command_len, cwd_len = entry->cwd ? entry->cwd_len : 0;
+    if (command_len > UINT16_MAX || cwd_len > UINT16_MAX ||
+        sizeof(record_header_t) + command_len + cwd_len + 1 > size) {
+        return 0;
+    }
+    record_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = RECORD_MAGIC;
+    header.command_len = (uint16_t)command_len;
+    header.cwd_len = (uint16_t)cwd_len;
+    header.status = entry->status;
+    header.job_id = entry->job_id;
+    header.start_us = entry->start_us;
+    header.duration_ms = (uint32_t)entry->duration_ms;
+    memcpy(buf, &header, sizeof(header));
+    memcpy(buf + sizeof(header), entry->command, command_len);
+    if (cwd_len) memcpy(buf + sizeof(header) + command_len, entry->cwd, cwd_len);
+    buf[sizeof(header) + command_len + cwd_len] = '\n';
+    return sizeof(header) + command_len + cwd_len + 1;
+}
+
+// Start the index over as belonging to the journal as it is now
+static int reset_index(void) {
+    struct stat st;
+    index_header_t header;
+    if (fstat(journal_fd, &st) == -1 || ftruncate(index_fd, 0) == -1) {
+        return -1;
+    }
+    memcpy(header.magic, index_magic, sizeof(header.magic));
+    header.journal_ino = (uint64_t)st.st_ino;
+    records = 0;
+    return write_all(index_fd, &header, sizeof(header));
+}
+
+// Index the records from scan_from on, a chunk at a time, and cut off
+// whatever follows the last complete one
+static int index_tail(uint64_t scan_from) {
+    char *buf = malloc(SCAN_CHUNK);
+    uint64_t batch[512];
+    int nbatch = 0, failed = 0;
+    if (!buf) return -1;
+    uint64_t pos = scan_from;
+    while (pos < journal_size && !failed) {
+        ssize_t n = pread(journal_fd, buf, SCAN_CHUNK, (off_t)pos);
+        if (n <= 0) break;
+        size_t used = 0, len;
+        record_header_t header;
+        while (!failed && (len = record_length(buf + used, (size_t)n - used, &header)) > 0) {
+            batch[nbatch++] = pos + used;
+            used += len;
+            if (nbatch == (int)(sizeof(batch) / sizeof(batch[0]))) {
+                // Only what made it to the index counts; the next repair cuts off the rest
+                failed = write_all(index_fd, batch, sizeof(batch)) == -1;
+                if (!failed) {
+                    records += nbatch;
+                }
+                nbatch = 0;
+            }
+        }
+        if (used == 0) {
+            break; // torn or garbage: nothing more to index
+        }
+        pos += used;
+    }
+    free(buf);
+    if (nbatch > 0 && !failed) {
+        failed = write_all(index_fd, batch, (size_t)nbatch * sizeof(uint64_t)) == -1;
+        if (!failed) {
+            records += nbatch;
+        }
+    }
+    if (pos < journal_size && !failed) {
+        if (ftruncate(journal_fd, (off_t)pos) == -1) {
+            perror("log: recovering history");
+        } else {
+            journal_size = pos;
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+// Bring the index in line with the journal: drop entries that do not point
+// at a complete record and index the records after the last one indexed
+static int repair_index(void) {
+    struct stat st;
+    index_header_t header;
+    if (fstat(journal_fd, &st) == -1) {
+        return -1;
+    }
+    journal_size = (uint64_t)st.st_size;
+
+    off_t isize = lseek(index_fd, 0, SEEK_END);
+    if (isize < (off_t)sizeof(header) ||
+        pread(index_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, index_magic, sizeof(header.magic)) != 0 ||
+        header.journal_ino != (uint64_t)st.st_ino) {
+        if (reset_index() == -1) return -1;
+    } else {
+        records = (long)((isize - (off_t)sizeof(header)) / (off_t)sizeof(uint64_t));
+    }
+
+    uint64_t scan_from = sizeof(journal_magic);
+    while (records > 0) {
+        uint64_t off;
+        off_t at = (off_t)sizeof(header) + (off_t)(records - 1) * (off_t)sizeof(uint64_t);
+        if (pread(index_fd, &off, sizeof(off), at) != (ssize_t)sizeof(off)) {
+            return -1;
+        }
+        record_header_t rec;
+        char nl;
+        if (off < journal_size && pread(journal_fd, &rec, sizeof(rec), (off_t)off) == (ssize_t)sizeof(rec)) {
+            uint64_t end = off + sizeof(rec) + rec.command_len + rec.cwd_len + 1;
+            if (rec.magic == RECORD_MAGIC && end <= journal_size &&
+                pread(journal_fd, &nl, 1, (off_t)end - 1) == 1 && nl == '\n') {
+                scan_from = end;
+                break;
+            }
+        }
+        records--;
+    }
+    off_t indexed = (off_t)sizeof(header) + (off_t)records * (off_t)sizeof(uint64_t);
+    if (indexed != isize && ftruncate(index_fd, indexed) == -1) {
+        return -1;
+    }
+    return index_tail(scan_from);
+}
+
+// Rewrite a journal of plain lines (the format before records had fields)
+// as records whose fields are unknown, and rename it over the old one
+static int convert_legacy_journal(void) {
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", journal_path);
+    FILE *in = fopen(journal_path, "r");
+    int out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ok = in && out != -1 && write_all(out, journal_magic, sizeof(journal_magic)) == 0;
+
+    char line[MAX_INPUT_SIZE + 1];
+    char record[sizeof(record_header_t) + sizeof(line) + 1];
+    while (ok && fgets(line, sizeof(line), in)) {
+        size_t len = strcspn(line, "\n");
+        if (len == 0 || (line[len] != '\n' && !feof(in))) {
+            continue; // Skip empty lines, and the pieces of overlong ones
+        }
+        history_entry_t entry = { 0, 0, HISTORY_STATUS_UNKNOWN, 0, line, len, NULL, 0 };
+        size_t n = encode_record(record, sizeof(record), &entry);
+        ok = n > 0 && write_all(out, record, n) == 0;
+    }
+    ok = ok && fsync(out) == 0 && rename(tmp_path, journal_path) == 0;
+    if (in) fclose(in);
+    if (out != -1) close(out);
+    if (!ok) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+// Make sure the journal starts with journal_magic: write it into a new (or
+// torn) journal, convert an old one. journal_fd is reopened if the journal
+// was replaced
+static int check_format(void) {
+    char magic[sizeof(journal_magic)];
+    ssize_t n = pread(journal_fd, magic, sizeof(magic), 0);
+    if (n == (ssize_t)sizeof(magic) && memcmp(magic, journal_magic, sizeof(magic)) == 0) {
+        return 0;
+    }
+    if (n >= 0 && memcmp(magic, journal_magic, (size_t)n) == 0) {
+        // Empty, or its header torn by a crash
+        if (ftruncate(journal_fd, 0) == -1) return -1;
+        return write_all(journal_fd, journal_magic, sizeof(journal_magic));
+    }
+    if (convert_legacy_journal() == -1) {
+        return -1;
+    }
+    close(journal_fd);
+    journal_fd = open(journal_path, O_RDWR | O_APPEND | O_CLOEXEC);
+    return journal_fd == -1 ? -1 : 0;
+}
+
+// Serialize writers across sessions. Returns -1 if the lock file cannot be
+// opened; everything is then done unlocked
+static int history_lock(void) {
+    if (lock_fd == -1) {
+        lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (lock_fd == -1) return -1;
+    }
+    while (flock(lock_fd, LOCK_EX) == -1) {
+        if (errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+static void history_unlock(void) {
+    if (lock_fd != -1) {
+        flock(lock_fd, LOCK_UN);
+    }
+}
+
+// Open the journal (if it exists, or create is set) and its index, repairing
+// the index where it falls behind. The lock must be held
+static int open_files(int create) {
+    close_files();
+    journal_fd = open(journal_path, O_RDWR | O_APPEND | O_CLOEXEC | (create ? O_CREAT : 0), 0644);
+    if (journal_fd == -1) {
+        return create ? -1 : 0; // No history file exists yet
+    }
+    if (check_format() == -1) {
+        perror("log: history journal");
+        close_files();
+        return -1;
+    }
+    index_fd = open(index_path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (index_fd == -1 || repair_index() == -1) {
+        perror("log: history index");
+        close_files();
+        return -1;
+    }
+    return 0;
+}
+
+// Open the history journaled at path
+void history_open(const char *path) {
+    close_files();
+    if (snprintf(journal_path, sizeof(journal_path), "%s", path) >= (int)sizeof(journal_path)) {
+        journal_path[0] = '\0';
+        return;
+    }
+    snprintf(index_path, sizeof(index_path), "%s.idx", journal_path);
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", journal_path);
+    snprintf(trigram_path, sizeof(trigram_path), "%s.tri", journal_path);
+    history_lock();
+    open_files(0);
+    history_unlock();
+}
+
+// Has the journal been compacted or purged since it was opened?
+static int journal_replaced(void) {
+    struct stat path_st, fd_st;
+    if (stat(journal_path, &path_st) == -1) {
+        return journal_fd != -1;
+    }
+    return journal_fd == -1 || fstat(journal_fd, &fd_st) == -1 ||
+           path_st.st_ino != fd_st.st_ino || path_st.st_dev != fd_st.st_dev;
+}
+
+// Catch up with the entries other sessions appended since the last call.
+// Only the two files' sizes are looked at; nothing is reread
+void history_sync(void) {
+    if (!journal_path[0]) {
+        return;
+    }
+    if (journal_replaced()) {
+        history_lock();
+        open_files(0);
+        history_unlock();
+        return;
+    }
+    struct stat ist, jst;
+    if (journal_fd == -1 || fstat(index_fd, &ist) == -1 || fstat(journal_fd, &jst) == -1) {
+        return;
+    }
+    // A sibling's index append may be half visible: whole entries only
+    if (ist.st_size >= (off_t)sizeof(index_header_t)) {
+        long indexed = (long)(((uint64_t)ist.st_size - sizeof(index_header_t)) / sizeof(uint64_t));
+        if (indexed > records) {
+            records = indexed;
+        }
+    }
+    if ((uint64_t)jst.st_size > journal_size) {
+        journal_size = (uint64_t)jst.st_size;
+    }
+}
+
+long history_count(void) {
+    return records;
+}
+
+// Record n (0 = oldest). Its command and cwd point into the mapped journal
+// (not NUL-terminated) and stay valid until the next history_flush or
+// history_sync. Returns -1 if there is no such record
+int history_read(long n, history_entry_t *entry) {
+    if (n < 0 || n >= records || map_files() == -1) {
+        return -1;
+    }
+    uint64_t off = offsets[n];
+    record_header_t header;
+    if (off >= journal_mapped ||
+        record_length(journal_map + off, journal_mapped - (size_t)off, &header) == 0) {
+        return -1;
+    }
+    entry->start_us = header.start_us;
+    entry->duration_ms = header.duration_ms;
+    entry->status = header.status;
+    entry->job_id = header.job_id;
+    entry->command = journal_map + off + sizeof(header);
+    entry->command_len = header.command_len;
+    entry->cwd = entry->command + header.command_len;
+    entry->cwd_len = header.cwd_len;
+    return 0;
+}
+
+// Keep the newest HISTORY_MAX records: copy them and their offsets (rebased)
+// into new files and rename those over the old ones
+static void compact_history(void) {
+    char tmp_journal[PATH_MAX + 8], tmp_index[PATH_MAX + 16];
+    snprintf(tmp_journal, sizeof(tmp_journal), "%s.tmp", journal_path);
+    snprintf(tmp_index, sizeof(tmp_index), "%s.tmp", index_path);
+    if (map_files() == -1) {
+        return;
+    }
+    long first = records - HISTORY_MAX;
+    uint64_t base = offsets[first];
+
+    int jfd = open(tmp_journal, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    int ifd = open(tmp_index, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    struct stat st;
+    int ok = jfd != -1 && ifd != -1 && fstat(jfd, &st) == 0 &&
+             write_all(jfd, journal_magic, sizeof(journal_magic)) == 0 &&
+             write_all(jfd, journal_map + base, journal_mapped - (size_t)base) == 0;
+    if (ok) {
+        index_header_t header;
+        memcpy(header.magic, index_magic, sizeof(header.magic));
+        header.journal_ino = (uint64_t)st.st_ino;
+        ok = write_all(ifd, &header, sizeof(header)) == 0;
+        uint64_t batch[512];
+        for (long n = first; ok && n < records;) {
+            int k = 0;
+            for (; k < 512 && n < records; k++, n++) {
+                batch[k] = offsets[n] - base + sizeof(journal_magic);
+            }
+            ok = write_all(ifd, batch, (size_t)k * sizeof(uint64_t)) == 0;
+        }
+    }
+    ok = ok && fsync(jfd) == 0 && fsync(ifd) == 0 &&
+         rename(tmp_journal, journal_path) == 0 && rename(tmp_index, index_path) == 0;
+    if (jfd != -1) close(jfd);
+    if (ifd != -1) close(ifd);
+    if (!ok) {
+        unlink(tmp_journal);
+        unlink(tmp_index);
+        return; // keep appending to the old journal
+    }
+    // The old files are gone: continue with the new ones
+    open_files(0);
+}
+
+// Write the records added since the last call: one append to the journal,
+// one to the index, under the lock. Called once the prompt is shown, so the
+// writes are off the path from a command to the next prompt
+void history_flush(void) {
+    if (pending_records == 0 || !journal_path[0]) {
+        return;
+    }
+    history_lock();
+    // Append after whatever the other sessions wrote, to the current files
+    int ok = journal_fd == -1 || journal_replaced() ? open_files(1) == 0 : repair_index() == 0;
+    uint64_t base = journal_size;
+    if (ok && write_all(journal_fd, pending, pending_len) == 0) {
+        for (int k = 0; k < pending_records; k++) {
+            pending_at[k] += base;
+        }
+        journal_size += pending_len;
+        if (write_all(index_fd, pending_at, (size_t)pending_records * sizeof(uint64_t)) == 0) {
+            records += pending_records;
+        }
+    }
+    pending_len = 0;
+    pending_records = 0;
+    if (records > HISTORY_MAX + COMPACT_SLACK) {
+        compact_history();
+    }
+    // Index the new records for log search, if there is an index to keep up
+    struct stat st;
+    if (journal_fd != -1 && fstat(journal_fd, &st) == 0) {
+        trigram_update(trigram_path, (uint64_t)st.st_ino, records, 0);
+    }
+    history_unlock();
+}
+
+// Up to max records older than record before matching pattern (a substring
+// or a glob), newest first, into matches (record numbers). Builds the trigram
+// index on first use
+long history_search(const char *pattern, long before, long *matches, long max) {
+    if (!journal_path[0]) {
+        return 0;
+    }
+    history_lock();
+    // Search what every session has written so far
+    if (journal_fd == -1 || journal_replaced()) {
+        open_files(0);
+    } else {
+        repair_index();
+    }
+    long found = 0;
+    struct stat st;
+    if (journal_fd != -1 && fstat(journal_fd, &st) == 0) {
+        trigram_update(trigram_path, (uint64_t)st.st_ino, records, 1);
+        found = trigram_search(pattern, before, matches, max);
+    }
+    history_unlock();
+    return found;
+}
+
+// Queue a record for the journal
+void history_append(const history_entry_t *entry) {
+    if (pending_records == PENDING_RECORDS) {
+        history_flush(); // lines entered faster than prompts are shown
+    }
+    size_t len = encode_record(pending + pending_len, sizeof(pending) - pending_len, entry);
+    if (len == 0 && pending_records > 0) {
+        history_flush();
+        len = encode_record(pending, sizeof(pending), entry);
+    }
+    if (len > 0) {
+        pending_at[pending_records++] = pending_len;
+        pending_len += len;
+    }
+}
+
+// Forget everything, in every session: both files are removed
+void history_purge(void) {
+    history_lock();
+    close_files();
+    pending_len = 0;
+    pending_records = 0;
+    trigram_close();
+    unlink(journal_path);
+    unlink(index_path);
+    unlink(trigram_path);
+    history_unlock();
+}
@@ -1,15 +1,52 @@
 #include "shell.h"
+#include "eventloop.h"
+#include <errno.h>
 
-int get_user_input(char *input) {
-    if (!fgets(input, MAX_INPUT_SIZE, stdin)) {
-        return -1; // EOF or error
+// stdin is read with read(2) whenever the event loop reports it ready.
+// Bytes past the current line stay here for the next call.
+static char in_buf[4 * MAX_INPUT_SIZE];
+static size_t in_len = 0;
+static int in_eof = 0;
+
+// Move the next line (without its newline) into input. Like fgets, a line
+// longer than MAX_INPUT_SIZE - 1 comes back in pieces
+static int take_line(char *input) {
+    char *nl = memchr(in_buf, '\n', in_len);
+    size_t line_len;
+    size_t consumed;
+
+    if (nl) {
+        line_len = (size_t)(nl - in_buf);
+        consumed = line_len + 1;
+    } else if (in_len >= MAX_INPUT_SIZE - 1 || (in_eof && in_len > 0)) {
+        line_len = in_len;
+        consumed = in_len;
+    } else {
+        return 0;
+    }
+    if (line_len > MAX_INPUT_SIZE - 1) {
+        line_len = MAX_INPUT_SIZE - 1;
+        consumed = line_len;
     }
-    
-    // Remove newline character
-    size_t len = strlen(input);
-    if (len > 0 && input[len - 1] == '\n') {
-        input[len - 1] = '\0';
+
+    memcpy(input, in_buf, line_len);
+    input[line_len] = '\0';
+    memmove(in_buf, in_buf + consumed, in_len - consumed);
+    in_len -= consumed;
+    return 1;
+}
+
+int get_user_input(char *input) {
+    while (!take_line(input)) {
+        if (in_eof || loop_wait_stdin() == -1) {
+            return -1; // EOF or error
+        }
+        ssize_t n = read(STDIN_FILENO, in_buf + in_len, sizeof(in_buf) - in_len);
+        if (n > 0) {
+            in_len += (size_t)n;
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN)) {
+            in_eof = 1;
+        }
     }
-    
     return 0;
-}
\ No newline at end of file
+}
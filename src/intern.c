@@ -0,0 +1,81 @@
+#include "intern.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+// string interning: one shared, immutable copy of each distinct string.
+// Thousands of jobs running the same command all point at one name.
+// Copies live in an arena and are never freed; the set only grows with
+// the number of *distinct* strings.
+
+#define INTERN_ARENA_BLOCK 4096
+#define INTERN_MIN_BUCKETS 64
+
+typedef struct interned {
+    struct interned *next;
+    unsigned hash;
+    char str[];
+} interned_t;
+
+static arena_t intern_arena = { NULL, NULL, INTERN_ARENA_BLOCK };
+static interned_t **buckets = NULL;
+static size_t bucket_count = 0;  // power of two
+static size_t interned_count = 0;
+
+static unsigned hash_str(const char *s) {
+    unsigned h = 2166136261u; // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Double the bucket array once there is more than one string per bucket
+static int grow(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : INTERN_MIN_BUCKETS;
+    interned_t **new_buckets = calloc(new_count, sizeof(interned_t *));
+    if (!new_buckets) return -1;
+
+    for (size_t b = 0; b < bucket_count; b++) {
+        interned_t *e = buckets[b];
+        while (e) {
+            interned_t *next = e->next;
+            size_t nb = e->hash & (new_count - 1);
+            e->next = new_buckets[nb];
+            new_buckets[nb] = e;
+            e = next;
+        }
+    }
+    free(buckets);
+    buckets = new_buckets;
+    bucket_count = new_count;
+    return 0;
+}
+
+// The shared copy of s; NULL only if memory runs out
+const char *intern(const char *s) {
+    unsigned h = hash_str(s);
+
+    if (bucket_count) {
+        for (interned_t *e = buckets[h & (bucket_count - 1)]; e; e = e->next) {
+            if (e->hash == h && strcmp(e->str, s) == 0) {
+                return e->str;
+            }
+        }
+    }
+    if (interned_count >= bucket_count && grow() == -1 && !bucket_count) {
+        return NULL;
+    }
+
+    size_t len = strlen(s);
+    interned_t *e = arena_alloc(&intern_arena, sizeof(interned_t) + len + 1);
+    if (!e) return NULL;
+    e->hash = h;
+    memcpy(e->str, s, len + 1);
+    size_t b = h & (bucket_count - 1);
+    e->next = buckets[b];
+    buckets[b] = e;
+    interned_count++;
+    return e->str;
+}
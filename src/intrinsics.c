@@ -1,67 +1,81 @@
 #include "shell.h"
+#include "intrinsics.h"
+#include "cgroup.h"
+#include "watchdog.h"
+#include "joblog.h"
 #include <string.h>
 
-// Check if a command is an intrinsic command
-int is_intrinsic_command(const char *command) {
-    if (!command) {
-        return 0;
-    }
-    
-    // List of all intrinsic commands
-    if (strcmp(command, "hop") == 0) {
-        return 1;
-    }
-    
-    // Add more intrinsic commands here as they are implemented
-    // if (strcmp(command, "reveal") == 0) return 1;
-    // if (strcmp(command, "log") == 0) return 1;
-    // if (strcmp(command, "proclore") == 0) return 1;
-    // if (strcmp(command, "seek") == 0) return 1;
-    
-    return 0;
+// Compile-time table of all intrinsic commands; adding a built-in means
+// adding a row here and a case to find_intrinsic()
+
+enum {
+    I_HOP,
+    I_REVEAL,
+    I_LOG,
+    I_ACTIVITIES,
+    I_PING,
+    I_FG,
+    I_BG,
+    I_HASH,
+    I_PLANCACHE,
+    I_MAXJOBS,
+    I_PARALLEL,
+    I_LIMIT,
+    I_TIMEOUT,
+    I_JOBLOG,
+    I_WAIT
+};
+
+static const intrinsic_t intrinsic_table[] = {
+    // hop in a pipeline or in the background runs in a child, like a subshell cd
+    [I_HOP]        = { "hop",        hop,               0 },
+    [I_REVEAL]     = { "reveal",     reveal,            INTRINSIC_PIPE_SAFE },
+    [I_LOG]        = { "log",        log_command,       INTRINSIC_PIPE_SAFE },
+    [I_ACTIVITIES] = { "activities", activities,        INTRINSIC_PIPE_SAFE },
+    [I_PING]       = { "ping",       ping,              INTRINSIC_PIPE_SAFE },
+    [I_FG]         = { "fg",         fg,                INTRINSIC_PARENT },
+    [I_BG]         = { "bg",         bg,                INTRINSIC_PARENT },
+    [I_HASH]       = { "hash",       hash_command,      INTRINSIC_PIPE_SAFE },
+    [I_PLANCACHE]  = { "plancache",  plancache_command, INTRINSIC_PIPE_SAFE },
+    [I_MAXJOBS]    = { "maxjobs",    maxjobs_command,   INTRINSIC_PIPE_SAFE },
+    [I_PARALLEL]   = { "parallel",   parallel_command,  INTRINSIC_PIPE_SAFE | INTRINSIC_READS_STDIN },
+    [I_LIMIT]      = { "limit",      limit_command,     INTRINSIC_PREFIX },
+    [I_TIMEOUT]    = { "timeout",    timeout_command,   INTRINSIC_PREFIX },
+    [I_JOBLOG]     = { "joblog",     joblog_command,    INTRINSIC_PIPE_SAFE },
+    [I_WAIT]       = { "wait",       wait_command,      INTRINSIC_PARENT },
+};
+
+static const intrinsic_t *match(const char *name, int id) {
+    return strcmp(name, intrinsic_table[id].name) == 0 ? &intrinsic_table[id] : NULL;
 }
 
-// Execute intrinsic command - dispatcher function
-int execute_intrinsic(char **tokens, int token_count) {
-    if (token_count == 0 || !tokens[0]) {
-        return 1;
-    }
-    
-    // Dispatch to appropriate intrinsic command handler
-    if (strcmp(tokens[0], "hop") == 0) {
-        return hop(tokens, token_count);
+// Look a command name up: the length (and at most one character) picks the
+// single candidate, so a non-built-in costs one strcmp at most
+const intrinsic_t *find_intrinsic(const char *name) {
+    if (!name) {
+        return NULL;
     }
-    
-    // Add more intrinsic command handlers here
-    /*
-    if (strcmp(tokens[0], "reveal") == 0) {
-        return execute_reveal(&tokens[1], token_count - 1);
-    }
-    
-    if (strcmp(tokens[0], "log") == 0) {
-        return execute_log(&tokens[1], token_count - 1);
-    }
-    
-    if (strcmp(tokens[0], "proclore") == 0) {
-        return execute_proclore(&tokens[1], token_count - 1);
-    }
-    
-    if (strcmp(tokens[0], "seek") == 0) {
-        return execute_seek(&tokens[1], token_count - 1);
-    }
-    */
-    
-    return 1; // Unknown intrinsic command
-}
 
-// Cleanup all intrinsic commands
-void cleanup_intrinsics(void) {
-    // Call cleanup functions for all intrinsic commands
-    cleanup_hop();
-    
-    // Add cleanup calls for other intrinsic commands as needed
-    // cleanup_reveal();
-    // cleanup_log();
-    // cleanup_proclore();
-    // cleanup_seek();
+    switch (strlen(name)) {
+    case 2:
+        return match(name, name[0] == 'f' ? I_FG : I_BG);
+    case 3:
+        return match(name, name[0] == 'h' ? I_HOP : I_LOG);
+    case 4:
+        return match(name, name[0] == 'p' ? I_PING : name[0] == 'h' ? I_HASH : I_WAIT);
+    case 5:
+        return match(name, I_LIMIT);
+    case 6:
+        return match(name, name[0] == 'r' ? I_REVEAL : I_JOBLOG);
+    case 7:
+        return match(name, name[0] == 'm' ? I_MAXJOBS : I_TIMEOUT);
+    case 8:
+        return match(name, I_PARALLEL);
+    case 9:
+        return match(name, I_PLANCACHE);
+    case 10:
+        return match(name, I_ACTIVITIES);
+    default:
+        return NULL;
+    }
 }
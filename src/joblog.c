@@ -0,0 +1,328 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include "joblog.h"
+#include "bg_jobs.h"
+#include "eventloop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Each captured job keeps its newest JOBLOG_RING bytes in memory. Older
+// output moves to a spill file, created only once a job has written more
+// than that, so fifty chatty jobs cost fifty rings and no temp files until
+// one of them overflows. A log outlives its job (the pipe is drained until
+// every writer is gone); the newest JOBLOG_KEEP finished logs are kept.
+//
+// Byte offsets run over everything a job wrote: [0, in_file) is in the spill
+// file, [in_file, spilled) was lost to a failed spill, and [spilled,
+// spilled + len) is in the ring.
+
+#define JOBLOG_RING (64 * 1024)
+#define JOBLOG_READ 4096
+#define JOBLOG_READS_PER_WAKE 16  // a job writing nonstop cannot starve the loop
+#define JOBLOG_KEEP 32
+
+struct job_output {
+    int job_id;                    // 0 until bound, -1 if it never became a job
+    const char *command;           // interned
+    int fd;                        // read end of the pipe, -1 at EOF
+    char *ring;                    // JOBLOG_RING bytes, allocated on first output
+    size_t head, len;
+    int spill_fd;                  // -1 until the ring first overflows
+    int spill_failed;
+    unsigned long long in_file;
+    unsigned long long spilled;
+    int following;                 // joblog -f is reading it: never evicted
+    struct job_output *next;       // newest first
+};
+
+static job_output_t *logs = NULL;
+static int capture = 0;
+static int finished_logs = 0;
+
+static unsigned long long output_end(const job_output_t *out) {
+    return out->spilled + out->len;
+}
+
+static int open_spill_file(void) {
+    const char *dir = getenv("TMPDIR");
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/joblog-XXXXXX", dir && *dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        return -1;
+    }
+    unlink(path); // gone with the last descriptor
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+// Move the oldest n bytes of a job's output out of memory
+static void spill(job_output_t *out, const char *data, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    if (out->spill_fd == -1 && !out->spill_failed) {
+        out->spill_fd = open_spill_file();
+        out->spill_failed = out->spill_fd == -1;
+    }
+    size_t written = 0;
+    while (!out->spill_failed && written < n) {
+        ssize_t w = write(out->spill_fd, data + written, n - written);
+        if (w == -1 && errno == EINTR) continue;
+        if (w <= 0) {
+            // Everything from here on is dropped, so the file stays a prefix
+            out->spill_failed = 1;
+            break;
+        }
+        written += (size_t)w;
+    }
+    out->in_file += written;
+    out->spilled += n;
+}
+
+static void append_output(job_output_t *out, const char *data, size_t n) {
+    size_t cap = out->ring ? JOBLOG_RING : 0;
+    if (out->len + n > cap) {
+        size_t excess = out->len + n - cap;
+        size_t from_ring = excess < out->len ? excess : out->len;
+        size_t first = from_ring < cap - out->head ? from_ring : cap - out->head;
+        spill(out, out->ring + out->head, first);
+        spill(out, out->ring, from_ring - first);
+        out->head = cap ? (out->head + from_ring) % cap : 0;
+        out->len -= from_ring;
+        if (excess > from_ring) {
+            spill(out, data, excess - from_ring);
+            data += excess - from_ring;
+            n -= excess - from_ring;
+        }
+    }
+    if (n == 0) {
+        return;
+    }
+    size_t tail = (out->head + out->len) % cap;
+    size_t first = n < cap - tail ? n : cap - tail;
+    memcpy(out->ring + tail, data, first);
+    memcpy(out->ring, data + first, n - first);
+    out->len += n;
+}
+
+static void free_output(job_output_t *out) {
+    if (out->fd != -1) {
+        loop_unwatch_fd(out->fd);
+        close(out->fd);
+    }
+    if (out->spill_fd != -1) {
+        close(out->spill_fd);
+    }
+    free(out->ring);
+    free(out);
+}
+
+// Drop the oldest finished logs beyond JOBLOG_KEEP
+static void evict_finished(void) {
+    while (finished_logs > JOBLOG_KEEP) {
+        job_output_t **victim = NULL;
+        for (job_output_t **pp = &logs; *pp; pp = &(*pp)->next) {
+            if ((*pp)->fd == -1 && !(*pp)->following) {
+                victim = pp; // the last match is the oldest
+            }
+        }
+        if (!victim) {
+            return;
+        }
+        job_output_t *out = *victim;
+        *victim = out->next;
+        free_output(out);
+        finished_logs--;
+    }
+}
+
+// loop_fd_fn of the pipes: take in what the job wrote
+static int drain_output(int fd, void *arg) {
+    job_output_t *out = arg;
+    char buf[JOBLOG_READ];
+    ssize_t n = -1;
+
+    for (int i = 0; i < JOBLOG_READS_PER_WAKE; i++) {
+        n = read(fd, buf, sizeof(buf));
+        if (n <= 0) break;
+        if (!out->ring) {
+            out->ring = malloc(JOBLOG_RING); // without one, everything spills
+        }
+        append_output(out, buf, (size_t)n);
+    }
+    if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+        // Every process holding the write end is gone
+        loop_unwatch_fd(fd);
+        close(fd);
+        out->fd = -1;
+        finished_logs++;
+        evict_finished();
+    }
+    return 0;
+}
+
+// A log for the next background job, if capture is on: its processes get
+// *write_fd as stdout/stderr, which the caller closes once they are spawned.
+// NULL when capture is off or impossible (e.g. in a forked child)
+job_output_t *joblog_open(int *write_fd) {
+    int fds[2];
+    *write_fd = -1;
+    if (!capture || pipe2(fds, O_CLOEXEC) == -1) {
+        return NULL;
+    }
+    job_output_t *out = calloc(1, sizeof(job_output_t));
+    if (!out) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    out->fd = fds[0];
+    out->spill_fd = -1;
+    fcntl(out->fd, F_SETFL, O_NONBLOCK);
+    if (loop_watch_fd(out->fd, drain_output, out) == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        free(out);
+        return NULL;
+    }
+    out->next = logs;
+    logs = out;
+    *write_fd = fds[1];
+    return out;
+}
+
+// The log's processes became job job_id (-1 if they could not be tracked)
+void joblog_bind(job_output_t *out, int job_id) {
+    if (!out) {
+        return;
+    }
+    bg_job_t *job = job_id > 0 ? find_job_by_number(job_id) : NULL;
+    out->job_id = job ? job_id : -1;
+    out->command = job ? job->command : NULL;
+}
+
+// Nothing could be spawned: forget the log
+void joblog_discard(job_output_t *out) {
+    if (!out) {
+        return;
+    }
+    for (job_output_t **pp = &logs; *pp; pp = &(*pp)->next) {
+        if (*pp == out) {
+            *pp = out->next;
+            break;
+        }
+    }
+    free_output(out);
+}
+
+// Write a job's output from byte offset from to its end to stdout. Returns
+// -1 once stdout can no longer be written (e.g. a closed pipe)
+static int write_output(const job_output_t *out, unsigned long long from) {
+    char buf[JOBLOG_READ];
+    while (from < out->in_file) {
+        size_t want = out->in_file - from < sizeof(buf) ? (size_t)(out->in_file - from) : sizeof(buf);
+        ssize_t n = pread(out->spill_fd, buf, want, (off_t)from);
+        if (n <= 0) break;
+        fwrite(buf, 1, (size_t)n, stdout);
+        from += (unsigned long long)n;
+    }
+    if (from < out->spilled) {
+        printf("[joblog: %llu bytes lost]\n", out->spilled - from);
+        from = out->spilled;
+    }
+    size_t skip = (size_t)(from - out->spilled);
+    if (skip < out->len) {
+        size_t start = (out->head + skip) % JOBLOG_RING;
+        size_t n = out->len - skip;
+        size_t first = n < JOBLOG_RING - start ? n : JOBLOG_RING - start;
+        fwrite(out->ring + start, 1, first, stdout);
+        fwrite(out->ring, 1, n - first, stdout);
+    }
+    int rc = fflush(stdout) == 0 && !ferror(stdout) ? 0 : -1;
+    clearerr(stdout);
+    return rc;
+}
+
+typedef struct {
+    const job_output_t *out;
+    unsigned long long pos;
+} follow_t;
+
+// loop_done_fn of joblog -f: new output, or the job is done writing
+static int output_changed(void *arg) {
+    const follow_t *follow = arg;
+    return output_end(follow->out) != follow->pos || follow->out->fd == -1;
+}
+
+// Newest log of job job_id
+static job_output_t *find_output(int job_id) {
+    for (job_output_t *out = logs; out; out = out->next) {
+        if (out->job_id == job_id) {
+            return out;
+        }
+    }
+    return NULL;
+}
+
+static void list_outputs(void) {
+    printf("capture: %s\n", capture ? "on" : "off");
+    for (job_output_t *out = logs; out; out = out->next) {
+        if (out->job_id == 0) {
+            continue;
+        }
+        printf("[%d] %s - %s, %llu bytes", out->job_id, out->command ? out->command : "?",
+               out->fd == -1 ? "Done" : "Writing", output_end(out));
+        if (out->spilled > 0) {
+            printf(" (%llu spilled)", out->spilled);
+        }
+        printf("\n");
+    }
+}
+
+// joblog                 capture mode and the captured logs
+// joblog on | off        capture the output of background jobs started from now on
+// joblog [-f] <job>      dump a job's output; -f keeps following it until the job
+//                        is done writing, its reader goes away (or Ctrl-C).
+//                        Other jobs' notices go to the shell's stdout meanwhile
+void joblog_command(int argc, char **argv) {
+    if (argc == 1) {
+        list_outputs();
+        fflush(stdout);
+        return;
+    }
+    if (argc == 2 && (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0)) {
+        capture = strcmp(argv[1], "on") == 0;
+        return;
+    }
+
+    int follow = argc == 3 && strcmp(argv[1], "-f") == 0;
+    if (argc != 2 + follow) {
+        fprintf(stderr, "Usage: joblog [on|off] | joblog [-f] <job>\n");
+        return;
+    }
+    const char *arg = argv[1 + follow];
+    char *end;
+    long job_id = strtol(arg[0] == '%' ? arg + 1 : arg, &end, 10);
+    job_output_t *out = *end == '\0' && job_id > 0 ? find_output((int)job_id) : NULL;
+    if (!out) {
+        fprintf(stderr, "No captured output for job %s\n", arg);
+        return;
+    }
+
+    follow_t state = { out, 0 };
+    out->following++;
+    while (1) {
+        int written = write_output(out, state.pos);
+        state.pos = output_end(out);
+        if (!follow || written == -1 || out->fd == -1 || loop_wait_until(output_changed, &state) == -1) {
+            break;
+        }
+    }
+    out->following--;
+    evict_finished();
+}
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include "launch.h"
+#include <spawn.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// spawn engine for external commands
+// posix_spawn in glibc is clone(CLONE_VM|CLONE_VFORK) + exec, so the shell's
+// address space (history, job table, environment) is never copied for a command.
+// fork() is only used for built-ins that have to run in a child process, and
+// for commands under resource limits (limit ...), which need setup in the child.
+
+extern char **environ;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 35))
+#define HAVE_SPAWN_TCSETPGRP 1
+#endif
+
+#ifndef CLONE_INTO_CGROUP
+#define CLONE_INTO_CGROUP 0x200000000ULL // Linux 5.7
+#endif
+
+#ifndef PIDFD_SIGNAL_PROCESS_GROUP
+#define PIDFD_SIGNAL_PROCESS_GROUP (1U << 2) // Linux 6.9
+#endif
+
+// Signals the shell handles or ignores that a child must get back as default
+static const int reset_signals[] = { SIGINT, SIGTSTP, SIGTTIN, SIGTTOU, SIGQUIT, SIGCHLD, SIGPIPE };
+
+void launch_opts_init(launch_opts_t *opts) {
+    opts->stdin_fd = -1;
+    opts->stdout_fd = -1;
+    opts->stderr_fd = -1;
+    opts->pgid = 0;
+    opts->foreground = 0;
+    opts->background = 0;
+    opts->cgroup_fd = -1;
+    opts->mem_limit = 0;
+    opts->nice = 0;
+}
+
+static pid_t fork_child(const launch_opts_t *opts, int exec_only);
+
+static int has_limits(const launch_opts_t *opts) {
+    return opts->cgroup_fd >= 0 || opts->mem_limit > 0 || opts->nice != 0;
+}
+
+// Run path in a fork_child() child so the limits in opts can be applied first.
+// The exec error comes back over a close-on-exec pipe.
+static int launch_limited(const char *path, char *const argv[], const launch_opts_t *opts, pid_t *pid_out) {
+    int errpipe[2];
+    if (pipe2(errpipe, O_CLOEXEC) == -1) {
+        return errno;
+    }
+
+    pid_t pid = fork_child(opts, 1);
+    if (pid == -1) {
+        int err = errno;
+        close(errpipe[0]);
+        close(errpipe[1]);
+        return err;
+    }
+    if (pid == 0) {
+        close(errpipe[0]);
+        execve(path, argv, environ);
+        int err = errno;
+        ssize_t n = write(errpipe[1], &err, sizeof(err));
+        (void)n;
+        _exit(127);
+    }
+
+    close(errpipe[1]);
+    int err = 0;
+    ssize_t n;
+    while ((n = read(errpipe[0], &err, sizeof(err))) == -1 && errno == EINTR) {
+    }
+    close(errpipe[0]);
+    if (n == (ssize_t)sizeof(err)) {
+        waitpid(pid, NULL, 0);
+        return err;
+    }
+    if (pid_out) *pid_out = pid;
+    return 0;
+}
+
+// Translate the stdin/stdout/stderr part of opts into spawn file actions
+static int build_file_actions(posix_spawn_file_actions_t *fa, const launch_opts_t *opts) {
+    int rc = 0;
+
+    if (opts->stdin_fd >= 0) {
+        rc = posix_spawn_file_actions_adddup2(fa, opts->stdin_fd, STDIN_FILENO);
+    } else if (opts->background) {
+        rc = posix_spawn_file_actions_addopen(fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    }
+    if (rc != 0) return rc;
+
+    if (opts->stdout_fd >= 0) {
+        rc = posix_spawn_file_actions_adddup2(fa, opts->stdout_fd, STDOUT_FILENO);
+    }
+    if (rc != 0) return rc;
+
+    if (opts->stderr_fd >= 0) {
+        rc = posix_spawn_file_actions_adddup2(fa, opts->stderr_fd, STDERR_FILENO);
+    }
+    if (rc != 0) return rc;
+
+#ifdef HAVE_SPAWN_TCSETPGRP
+    // Runs after setpgid in the child, with every signal still blocked
+    if (opts->foreground && isatty(STDIN_FILENO)) {
+        rc = posix_spawn_file_actions_addtcsetpgrp_np(fa, STDIN_FILENO);
+    }
+#endif
+    return rc;
+}
+
+// Spawn the program at path (already resolved, see hash.c) without forking the shell.
+// Returns 0 on success or an errno value, like posix_spawn itself.
+int launch_command(const char *path, char *const argv[], const launch_opts_t *opts, pid_t *pid_out) {
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t defaults, no_mask;
+    pid_t pid = 0;
+    int rc;
+
+    if (has_limits(opts)) {
+        return launch_limited(path, argv, opts, pid_out);
+    }
+    if ((rc = posix_spawn_file_actions_init(&fa)) != 0) {
+        return rc;
+    }
+    if ((rc = posix_spawnattr_init(&attr)) != 0) {
+        posix_spawn_file_actions_destroy(&fa);
+        return rc;
+    }
+
+    sigemptyset(&defaults);
+    for (size_t i = 0; i < sizeof(reset_signals) / sizeof(reset_signals[0]); i++) {
+        sigaddset(&defaults, reset_signals[i]);
+    }
+
+    // The shell blocks the signals its event loop reads; children start unblocked
+    sigemptyset(&no_mask);
+
+    rc = build_file_actions(&fa, opts);
+    if (rc == 0) rc = posix_spawnattr_setsigdefault(&attr, &defaults);
+    if (rc == 0) rc = posix_spawnattr_setsigmask(&attr, &no_mask);
+    if (rc == 0) rc = posix_spawnattr_setpgroup(&attr, opts->pgid);
+    if (rc == 0) rc = posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGDEF |
+                                                         POSIX_SPAWN_SETSIGMASK);
+    if (rc == 0) rc = posix_spawn(&pid, path, &fa, &attr, argv, environ);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&fa);
+    if (rc != 0) {
+        return rc;
+    }
+
+    // Mirror the child's setpgid so the group exists before we return
+    setpgid(pid, opts->pgid ? opts->pgid : pid);
+#ifndef HAVE_SPAWN_TCSETPGRP
+    if (opts->foreground && isatty(STDIN_FILENO)) {
+        tcsetpgrp(STDIN_FILENO, opts->pgid ? opts->pgid : pid);
+    }
+#endif
+    if (pid_out) *pid_out = pid;
+    return 0;
+}
+
+// fork() straight into the cgroup behind cgroup_fd, so that not even the
+// child's setup runs outside its limits. Falls back to a plain fork() on
+// kernels without clone3 or CLONE_INTO_CGROUP (*joined is then 0).
+// The raw clone3 skips glibc's fork bookkeeping (atfork handlers, the
+// thread's cached tid, resetting stdio and malloc locks), so the child may
+// only make async-signal-safe calls before it execs: launch_limited() only
+static pid_t fork_into_cgroup(int cgroup_fd, int *joined) {
+#ifdef SYS_clone3
+    struct {
+        uint64_t flags, pidfd, child_tid, parent_tid, exit_signal;
+        uint64_t stack, stack_size, tls, set_tid, set_tid_size, cgroup;
+    } args;
+    memset(&args, 0, sizeof(args));
+    args.flags = CLONE_INTO_CGROUP;
+    args.exit_signal = SIGCHLD;
+    args.cgroup = (uint64_t)cgroup_fd;
+    long pid = syscall(SYS_clone3, &args, sizeof(args));
+    if (pid != -1 || (errno != ENOSYS && errno != E2BIG && errno != EINVAL)) {
+        *joined = 1;
+        return (pid_t)pid;
+    }
+#else
+    (void)cgroup_fd;
+#endif
+    *joined = 0;
+    return fork();
+}
+
+// Resource limits of opts, applied in the child before anything else runs.
+// Plain system calls only (see fork_into_cgroup)
+static void apply_limits(const launch_opts_t *opts, int joined) {
+    if (opts->cgroup_fd >= 0 && !joined) {
+        int fd = openat(opts->cgroup_fd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+        if (fd != -1) {
+            ssize_t n = write(fd, "0", 1);
+            (void)n;
+            close(fd);
+        }
+    }
+    if (opts->mem_limit > 0) {
+        struct rlimit rl = { (rlim_t)opts->mem_limit, (rlim_t)opts->mem_limit };
+        setrlimit(RLIMIT_AS, &rl);
+    }
+    if (opts->nice != 0) {
+        errno = 0;
+        if (nice(opts->nice) == -1 && errno != 0) {
+            static const char msg[] = "nice: cannot change the priority\n";
+            ssize_t n = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+            (void)n;
+        }
+    }
+}
+
+// Set up a new child as opts asks: limits, process group, terminal, default
+// signals and stdin/stdout/stderr. Plain system calls only (see fork_into_cgroup)
+static void setup_child(const launch_opts_t *opts, int joined) {
+    apply_limits(opts, joined);
+    setpgid(0, opts->pgid);
+    if (opts->foreground && isatty(STDIN_FILENO)) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+    }
+    struct sigaction dfl;
+    memset(&dfl, 0, sizeof(dfl));
+    dfl.sa_handler = SIG_DFL;
+    sigemptyset(&dfl.sa_mask);
+    for (size_t i = 0; i < sizeof(reset_signals) / sizeof(reset_signals[0]); i++) {
+        sigaction(reset_signals[i], &dfl, NULL);
+    }
+    sigset_t no_mask;
+    sigemptyset(&no_mask);
+    sigprocmask(SIG_SETMASK, &no_mask, NULL);
+    if (opts->stdin_fd >= 0) {
+        dup2(opts->stdin_fd, STDIN_FILENO);
+    } else if (opts->background) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (fd != -1) {
+            dup2(fd, STDIN_FILENO);
+            close(fd);
+        }
+    }
+    if (opts->stdout_fd >= 0) {
+        dup2(opts->stdout_fd, STDOUT_FILENO);
+    }
+    if (opts->stderr_fd >= 0) {
+        dup2(opts->stderr_fd, STDERR_FILENO);
+    }
+}
+
+// Fork a child set up as opts asks. exec_only: the child will only exec
+// (launch_limited), so it may be cloned straight into opts->cgroup_fd
+static pid_t fork_child(const launch_opts_t *opts, int exec_only) {
+    int joined = 0;
+    pid_t pid = opts->cgroup_fd >= 0 && exec_only ? fork_into_cgroup(opts->cgroup_fd, &joined) : fork();
+    if (pid == -1) {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0) {
+        setup_child(opts, joined);
+        return 0;
+    }
+    setpgid(pid, opts->pgid ? opts->pgid : pid);
+    return pid;
+}
+
+// Fallback for built-ins that must run in a child: fork and apply opts in the child.
+// Returns like fork(); stdin_fd/stdout_fd/stderr_fd are dup2'd in the child.
+// A real fork(), since the child goes on to run shell code: under a cgroup
+// it joins it itself, right after the fork
+pid_t launch_fork(const launch_opts_t *opts) {
+    return fork_child(opts, 0);
+}
+
+// A pidfd names one process for good: unlike a pid it can never start
+// referring to another process after the original one is reaped.
+// Returns -1 (errno set) where pidfds are unavailable
+int open_pidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int pidfd_signal(int pidfd, int sig, unsigned flags) {
+#ifdef SYS_pidfd_send_signal
+    return (int)syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, flags);
+#else
+    (void)pidfd; (void)sig; (void)flags;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+// Signal one process through its pidfd, or by pid when it has none
+int signal_process(int pidfd, pid_t pid, int sig) {
+    if (pidfd >= 0) {
+        return pidfd_signal(pidfd, sig, 0);
+    }
+    return kill(pid, sig);
+}
+
+// Signal the whole process group of pidfd's process (a job), falling back to
+// kill(-pgid) on kernels without PIDFD_SIGNAL_PROCESS_GROUP
+int signal_group(int pidfd, pid_t pgid, int sig) {
+    if (pidfd >= 0) {
+        int rc = pidfd_signal(pidfd, sig, PIDFD_SIGNAL_PROCESS_GROUP);
+        if (rc == 0 || (errno != EINVAL && errno != ENOSYS)) {
+            return rc;
+        }
+    }
+    return kill(-pgid, sig);
+}
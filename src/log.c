@@ -1,66 +1,47 @@
 #include "shell.h"
+#include "history.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <time.h>
 
-#define MAX_COMMANDS 15 // keeps only last 15 commands
+#define MAX_COMMANDS 15 // log shows the last 15 commands by default
 #define LOG_FILE ".shell_history" // load from .shell_history file on startup
 #define MAX_CMD_LENGTH 1024
 
-// Global command history
-static char command_history[MAX_COMMANDS][MAX_CMD_LENGTH];
-static int history_count = 0; // no of valid entries in buffer
-static int history_start = 0; // Index of oldest command
+// The history itself lives in history.c (an append-only journal with a mapped
+// offset index, up to HISTORY_MAX commands); this is the log built-in on top
+
 static int skip_history = 0;  // Flag to skip adding to history
-// circular buffer
-// Load command history from file
+static int history_loaded = 0;
+static char last_command[MAX_CMD_LENGTH]; // newest entry, for the duplicate check
+
+// Open the history in the directory the shell started in
 void load_history(void) {
-    FILE *file = fopen(LOG_FILE, "r");
-    if (!file) {
-        return; // No history file exists yet
+    if (history_loaded) {
+        return;
     }
-    
-    char line[MAX_CMD_LENGTH];
-    history_count = 0;
-    history_start = 0;
-    
-    while (fgets(line, sizeof(line), file) && history_count < MAX_COMMANDS) {
-        // Remove newline
-        line[strcspn(line, "\n")] = 0;
-        
-        // Skip empty lines
-        if (strlen(line) == 0) {
-            continue;
-        }
-        
-        strcpy(command_history[history_count], line);
-        history_count++;
+    history_loaded = 1;
+    char cwd[PATH_MAX], path[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)) ||
+        snprintf(path, sizeof(path), "%s/%s", cwd, LOG_FILE) >= (int)sizeof(path)) {
+        strcpy(path, LOG_FILE);
     }
-    
-    fclose(file);
-}
+    history_open(path);
 
-// Save command history to file
-static void save_history(void) {
-    FILE *file = fopen(LOG_FILE, "w");
-    if (!file) {
-        return; // Could not create history file
+    history_entry_t last;
+    if (history_read(history_count() - 1, &last) == 0 && last.command_len < sizeof(last_command)) {
+        memcpy(last_command, last.command, last.command_len);
+        last_command[last.command_len] = '\0';
     }
-    
-    // Write commands from oldest to newest
-    for (int i = 0; i < history_count; i++) {
-        int idx = (history_start + i) % MAX_COMMANDS;
-        fprintf(file, "%s\n", command_history[idx]);
-    }
-    
-    fclose(file);
 }
 
-// Add command to history
-void add_to_history(const char *command) {
+// Add command to history, with how running it went (info; NULL if nothing
+// ran). A start_us of 0 means now, a NULL cwd the current directory
+void add_to_history(const char *command, const history_entry_t *info) {
     // Check skip flag first (for executed commands from history)
     if (skip_history) {
         return;
@@ -73,61 +54,95 @@ void add_to_history(const char *command) {
     }
     
     // Skip if command is identical to the last one (requirement #3)
-    if (history_count > 0) {
-        int last_idx = (history_start + history_count - 1) % MAX_COMMANDS;
-        if (strcmp(command_history[last_idx], command) == 0) {
-            return; // Skip duplicate
-        }
+    if (strcmp(last_command, command) == 0) {
+        return; // Skip duplicate
     }
     
-    // Determine where to place the new command (requirement #2 - circular buffer)
-    int new_idx;
-    if (history_count < MAX_COMMANDS) {
-        // Still have room, just add to the end
-        new_idx = history_count;
-        history_count++;
-    } else {
-        // Buffer is full, overwrite the oldest
-        new_idx = history_start;
-        history_start = (history_start + 1) % MAX_COMMANDS;
+    // Store the command (requirement #4 - entire shell_cmd); it is written
+    // out once the next prompt is up (requirement #1 - persistence)
+    strncpy(last_command, command, MAX_CMD_LENGTH - 1);
+    last_command[MAX_CMD_LENGTH - 1] = '\0';
+
+    history_entry_t entry = { 0, 0, HISTORY_STATUS_UNKNOWN, 0, NULL, 0, NULL, 0 };
+    if (info) {
+        entry = *info;
     }
-    
-    // Store the command (requirement #4 - entire shell_cmd)
-    strncpy(command_history[new_idx], command, MAX_CMD_LENGTH - 1);
-    command_history[new_idx][MAX_CMD_LENGTH - 1] = '\0';
-    
-    // Save to file after each addition (requirement #1 - persistence)
-    save_history();
+    char cwd[PATH_MAX];
+    if (!entry.cwd && getcwd(cwd, sizeof(cwd))) {
+        entry.cwd = cwd;
+        entry.cwd_len = strlen(cwd);
+    }
+    if (entry.start_us == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        entry.start_us = (long long)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+    }
+    entry.command = last_command;
+    entry.command_len = strlen(last_command);
+    history_append(&entry);
 }
 
-// Print command history (requirement #6a - oldest to newest)
-static void print_history(void) {
-    if (history_count == 0) {
-        fflush(stdout); // Ensure output is flushed even when empty
-        return; // No history to show
+// One log -v line: when, how long, how it ended, its job, where, what
+static void print_entry(const history_entry_t *entry) {
+    char when[32] = "-", took[32] = "-", status[32] = "-", job[16] = "-";
+    if (entry->start_us > 0) {
+        time_t secs = (time_t)(entry->start_us / 1000000);
+        struct tm tm;
+        if (localtime_r(&secs, &tm)) {
+            strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        }
+        if (entry->duration_ms < 60000) {
+            snprintf(took, sizeof(took), "%lu.%03lus", entry->duration_ms / 1000, entry->duration_ms % 1000);
+        } else {
+            snprintf(took, sizeof(took), "%lum%02lus", entry->duration_ms / 60000, entry->duration_ms / 1000 % 60);
+        }
     }
+    if (entry->status != HISTORY_STATUS_UNKNOWN) {
+        snprintf(status, sizeof(status), "exit %d", entry->status);
+    }
+    if (entry->job_id > 0) {
+        snprintf(job, sizeof(job), "[%d]", entry->job_id);
+    }
+    printf("%-19s  %9s  %-8s  %-5s  %.*s  %.*s\n", when, took, status, job,
+           entry->cwd_len ? (int)entry->cwd_len : 1, entry->cwd_len ? entry->cwd : "-",
+           (int)entry->command_len, entry->command);
+}
+
+// Print the last count commands (requirement #6a - oldest to newest)
+static void print_history(long count, int verbose) {
+    long total = history_count();
+    long first = total > count ? total - count : 0;
     
     // Print from oldest to newest
-    for (int i = 0; i < history_count; i++) {
-        int idx = (history_start + i) % MAX_COMMANDS;
-        printf("%s\n", command_history[idx]);
+    for (long i = first; i < total; i++) {
+        history_entry_t entry;
+        if (history_read(i, &entry) == -1) {
+            continue;
+        }
+        if (verbose) {
+            print_entry(&entry);
+        } else {
+            fwrite(entry.command, 1, entry.command_len, stdout);
+            putchar('\n');
+        }
     }
     fflush(stdout); // Pipeline compatibility
 }
 
 // Execute command at given index (requirement #6c)
-static void execute_at_index(int index) {
-    if (index < 1 || index > history_count) {
-        fprintf(stderr, "Invalid index: %d\n", index); // Error to stderr
+static void execute_at_index(long index) {
+    // Index 1 = newest command, Index history_count() = oldest command
+    history_entry_t entry;
+    if (index < 1 || history_read(history_count() - index, &entry) == -1) {
+        fprintf(stderr, "Invalid index: %ld\n", index); // Error to stderr
         return;
     }
     
-    // Convert from one-indexed (newest first) to array index
-    // Index 1 = newest command, Index history_count = oldest command
-    int array_idx = (history_start + history_count - index) % MAX_COMMANDS;
+    // Copy it out: running it may remap the history
     char command_copy[MAX_CMD_LENGTH];
-    strncpy(command_copy, command_history[array_idx], MAX_CMD_LENGTH - 1);
-    command_copy[MAX_CMD_LENGTH - 1] = '\0';
+    size_t len = entry.command_len < MAX_CMD_LENGTH ? entry.command_len : MAX_CMD_LENGTH - 1;
+    memcpy(command_copy, entry.command, len);
+    command_copy[len] = '\0';
     
     // Print the command being executed (as shown in example)
     printf("%s\n", command_copy);
@@ -136,40 +151,101 @@ static void execute_at_index(int index) {
     // Set flag to prevent executed command from being added to history again
     skip_history = 1;
     // Execute the command without adding it to history (requirement #6c)
-    execute_command(command_copy);
+    if (!execute_command(command_copy)) {
+        printf("Invalid Syntax!\n");
+    }
     // Reset flag
     skip_history = 0;
 }
 
+// log search [-n count] <text>: the newest count commands containing text
+// (or matching it as a glob, with * ? [...]), newest first, each with the
+// index log execute takes. The words after the options are one pattern,
+// joined by single spaces
+static void search_history(int argc, char **argv) {
+    long count = MAX_COMMANDS;
+    int i = 2;
+    char *end = NULL;
+    if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+        count = strtol(argv[i + 1], &end, 10);
+        if (count <= 0 || *end != '\0') {
+            i = argc; // malformed: show usage
+        } else {
+            i += 2;
+        }
+    }
+    if (i >= argc) {
+        fprintf(stderr, "Usage: log search [-n count] <text|pattern>\n"); // Error to stderr
+        return;
+    }
+
+    char pattern[MAX_CMD_LENGTH];
+    size_t len = 0;
+    for (; i < argc; i++) {
+        int n = snprintf(pattern + len, sizeof(pattern) - len, "%s%s", len ? " " : "", argv[i]);
+        if (n < 0 || (size_t)n >= sizeof(pattern) - len) {
+            fprintf(stderr, "log search: pattern too long\n");
+            return;
+        }
+        len += (size_t)n;
+    }
+
+    long *matches = malloc((size_t)count * sizeof(long));
+    if (!matches) {
+        perror("malloc");
+        return;
+    }
+    long total = history_count();
+    long found = history_search(pattern, total, matches, count);
+    total = history_count(); // search merged in other sessions' commands
+    for (long k = 0; k < found; k++) {
+        history_entry_t entry;
+        if (history_read(matches[k], &entry) == 0) {
+            printf("%5ld  %.*s\n", total - matches[k], (int)entry.command_len, entry.command);
+        }
+    }
+    fflush(stdout); // Pipeline compatibility
+    free(matches);
+}
+
 // Clear command history (requirement #6b)
 static void purge_history(void) {
-    history_count = 0;
-    history_start = 0;
-    
     // Remove history file
-    unlink(LOG_FILE);
+    history_purge();
+    last_command[0] = '\0';
     fflush(stdout); // Pipeline compatibility
 }
 
 void log_command(int argc, char **argv) {
-    // Initialize history on first call
-    static int initialized = 0;
-    if (!initialized) {
-        load_history();
-        initialized = 1;
-    }
+    // Initialize history on first call, then merge in other sessions' commands
+    load_history();
+    history_sync();
     
-    if (argc == 1) {
-        // No arguments - print history (requirement #6a)
-        print_history();
+    if (argc >= 2 && strcmp(argv[1], "search") == 0) {
+        search_history(argc, argv);
     } else if (argc == 2 && strcmp(argv[1], "purge") == 0) {
         // Purge history (requirement #6b)
         purge_history();
     } else if (argc == 3 && strcmp(argv[1], "execute") == 0) {
         // Execute command at index (requirement #6c)
-        int index = atoi(argv[2]);
+        long index = atol(argv[2]);
         execute_at_index(index);
     } else {
-        fprintf(stderr, "Usage: log [purge | execute <index>]\n"); // Error to stderr
+        // Print history (requirement #6a): the last MAX_COMMANDS unless -n says otherwise
+        long count = MAX_COMMANDS;
+        int verbose = 0;
+        for (int i = 1; i < argc; i++) {
+            char *end = NULL;
+            if (strcmp(argv[i], "-v") == 0) {
+                verbose = 1;
+            } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc &&
+                       (count = strtol(argv[i + 1], &end, 10)) > 0 && *end == '\0') {
+                i++;
+            } else {
+                fprintf(stderr, "Usage: log [-v] [-n count] | search [-n count] <text> | purge | execute <index>\n"); // Error to stderr
+                return;
+            }
+        }
+        print_history(count, verbose);
     }
-}
\ No newline at end of file
+}
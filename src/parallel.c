@@ -0,0 +1,351 @@
+#include "shell.h"
+#include "bg_jobs.h"
+#include "launch.h"
+#include "eventloop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+// parallel [-j N] cmd [args...] runs cmd once per line of stdin, with every {}
+// in its words replaced by the line (the line is appended if there is no {}).
+//
+// N worker slots (default: the online CPUs) each own a deque of tasks, a
+// contiguous share of the input. A slot whose process finishes takes its next
+// task from the front of its own deque and, once that is empty, steals one
+// from the back of the fullest other deque, so tasks of uneven length still
+// keep every slot busy until the end.
+//
+// Inside the shell each task is a job (activities, fg and ping work on it) and
+// the prompt comes back at once: slots are refilled as the event loop reaps
+// their jobs. Tasks are limited by the N slots alone, not by maxjobs, and
+// neither hold up nor wait for queued & jobs. Everything parallel and its
+// tasks write goes to the stdout it was started with, even once it is
+// reporting from the event loop. In a forked child (parallel in the background, or fed by another
+// built-in) nothing reaps for us, so it waits for all its tasks itself.
+
+#define PARALLEL_MAX_SLOTS 1024
+#define PARALLEL_READ_CHUNK 4096
+
+typedef struct parallel_run parallel_run_t;
+
+typedef struct {
+    int head, tail;            // pending tasks [head, tail)
+} task_deque_t;
+
+typedef struct {
+    parallel_run_t *run;
+    int index;
+    int task;                  // task being run, -1 when idle
+    pid_t pid;
+} worker_slot_t;
+
+struct parallel_run {
+    char **words;              // command template, NULL terminated
+    int nwords;
+    char *input;               // all of stdin; tasks point into it
+    char **tasks;
+    int ntasks;
+    task_deque_t *deques;      // one per slot
+    worker_slot_t *slots;
+    int nslots;
+    int running;
+    int finished;
+    int failed;
+    int stolen;
+    int stdout_fd;             // where every task writes, fixed at the start
+    int owned;                 // tasks are jobs reaped by the shell's loop
+};
+
+// Next task for a slot: its own oldest one, else the newest of the fullest
+// other deque. -1 when every deque is empty
+static int next_task(parallel_run_t *run, int slot) {
+    task_deque_t *own = &run->deques[slot];
+    if (own->head < own->tail) {
+        return own->head++;
+    }
+    task_deque_t *victim = NULL;
+    for (int i = 0; i < run->nslots; i++) {
+        task_deque_t *d = &run->deques[i];
+        if (d->tail - d->head > (victim ? victim->tail - victim->head : 0)) {
+            victim = d;
+        }
+    }
+    if (!victim) {
+        return -1;
+    }
+    run->stolen++;
+    return --victim->tail;
+}
+
+// Replace every {} in word by arg (malloc'd)
+static char *substitute(const char *word, const char *arg) {
+    size_t count = 0;
+    for (const char *p = strstr(word, "{}"); p; p = strstr(p + 2, "{}")) count++;
+    size_t len = strlen(word) + count * strlen(arg) - count * 2;
+    char *out = malloc(len + 1);
+    if (!out) return NULL;
+
+    char *o = out;
+    const char *p = word;
+    for (const char *hit = strstr(p, "{}"); hit; hit = strstr(p, "{}")) {
+        memcpy(o, p, (size_t)(hit - p));
+        o += hit - p;
+        o = stpcpy(o, arg);
+        p = hit + 2;
+    }
+    strcpy(o, p);
+    return out;
+}
+
+static void free_argv(char **argv) {
+    for (int i = 0; argv[i]; i++) free(argv[i]);
+    free(argv);
+}
+
+// argv of one task
+static char **task_argv(const parallel_run_t *run, const char *arg) {
+    char **argv = calloc((size_t)run->nwords + 2, sizeof(char *));
+    if (!argv) return NULL;
+    int placeholder = 0;
+    for (int i = 0; i < run->nwords; i++) {
+        placeholder |= strstr(run->words[i], "{}") != NULL;
+        if (!(argv[i] = substitute(run->words[i], arg))) {
+            free_argv(argv);
+            return NULL;
+        }
+    }
+    if (!placeholder && !(argv[run->nwords] = strdup(arg))) {
+        free_argv(argv);
+        return NULL;
+    }
+    return argv;
+}
+
+static int task_exited(const bg_job_t *job, void *arg);
+
+// Start the slot's next task. Tasks that cannot be started count as failed.
+// Returns 1 if one is running, 0 if the slot has nothing left to do
+static int start_task(worker_slot_t *slot) {
+    parallel_run_t *run = slot->run;
+    int task;
+    while ((task = next_task(run, slot->index)) != -1) {
+        char **argv = task_argv(run, run->tasks[task]);
+        const char *path = argv ? lookup_command_path(argv[0]) : NULL;
+        pid_t pid = -1;
+        if (path) {
+            launch_opts_t opts;
+            launch_opts_init(&opts);
+            opts.stdout_fd = run->stdout_fd;
+            opts.background = 1;
+            if (launch_command(path, argv, &opts, &pid) != 0) {
+                pid = -1;
+            }
+        }
+        if (argv) free_argv(argv);
+
+        if (pid == -1) {
+            fprintf(stderr, "parallel: %s: Command not found!\n", run->words[0]);
+            run->finished++;
+            run->failed++;
+            continue;
+        }
+        if (run->owned && add_task_job(pid, run->words[0], task_exited, slot) == -1) {
+            // Runs on, but untracked: the shell's loop reaps it like any stray child
+            perror("parallel");
+            run->finished++;
+            run->failed++;
+            continue;
+        }
+        slot->task = task;
+        slot->pid = pid;
+        run->running++;
+        return 1;
+    }
+    slot->task = -1;
+    slot->pid = 0;
+    return 0;
+}
+
+static void free_run(parallel_run_t *run) {
+    if (run->stdout_fd != -1) close(run->stdout_fd);
+    if (run->words) {
+        for (int i = 0; i < run->nwords; i++) free(run->words[i]);
+        free(run->words);
+    }
+    free(run->input);
+    free(run->tasks);
+    free(run->deques);
+    free(run->slots);
+    free(run);
+}
+
+// Returns 1 if the summary went to the terminal
+static int finish_run(parallel_run_t *run) {
+    dprintf(run->stdout_fd, "parallel: %d tasks done, %d failed, %d stolen\n",
+            run->finished, run->failed, run->stolen);
+    int on_tty = isatty(run->stdout_fd);
+    free_run(run);
+    return on_tty;
+}
+
+// A slot's task is over: account for it and give the slot its next one.
+// Inside the shell the run ends (and is freed) with its last task.
+// Returns 1 if anything was printed on the terminal
+static int task_finished(worker_slot_t *slot, int status) {
+    parallel_run_t *run = slot->run;
+    int printed = 0;
+
+    run->running--;
+    run->finished++;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        run->failed++;
+        dprintf(run->stdout_fd, "parallel: %s exited abnormally\n", run->tasks[slot->task]);
+        printed = isatty(run->stdout_fd);
+    }
+    start_task(slot);
+    if (run->running == 0 && run->owned) {
+        printed |= finish_run(run);
+    }
+    return printed;
+}
+
+// job_exit_fn of the tasks' jobs
+static int task_exited(const bg_job_t *job, void *arg) {
+    return task_finished(arg, job->procs[0].wait_status);
+}
+
+// Read all of stdin and split it into non-empty lines
+static int read_tasks(parallel_run_t *run) {
+    size_t cap = PARALLEL_READ_CHUNK, len = 0;
+    run->input = malloc(cap + 1);
+    if (!run->input) return -1;
+    while (1) {
+        if (len == cap) {
+            char *grown = realloc(run->input, cap * 2 + 1);
+            if (!grown) return -1;
+            run->input = grown;
+            cap *= 2;
+        }
+        ssize_t n = read(STDIN_FILENO, run->input + len, cap - len);
+        if (n == 0) break;
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        len += (size_t)n;
+    }
+    run->input[len] = '\0';
+
+    size_t lines = 1;
+    for (size_t i = 0; i < len; i++) lines += run->input[i] == '\n';
+    run->tasks = malloc(lines * sizeof(char *));
+    if (!run->tasks) return -1;
+    for (char *line = run->input; line && *line; ) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        if (*line) run->tasks[run->ntasks++] = line;
+        line = nl ? nl + 1 : NULL;
+    }
+    return 0;
+}
+
+// Deal the tasks out to the slots in contiguous shares
+static int make_slots(parallel_run_t *run, int jobs) {
+    run->nslots = jobs < run->ntasks ? jobs : run->ntasks;
+    run->deques = calloc((size_t)run->nslots, sizeof(task_deque_t));
+    run->slots = calloc((size_t)run->nslots, sizeof(worker_slot_t));
+    if (!run->deques || !run->slots) return -1;
+    for (int i = 0; i < run->nslots; i++) {
+        run->deques[i].head = (int)((long)run->ntasks * i / run->nslots);
+        run->deques[i].tail = (int)((long)run->ntasks * (i + 1) / run->nslots);
+        run->slots[i].run = run;
+        run->slots[i].index = i;
+        run->slots[i].task = -1;
+    }
+    return 0;
+}
+
+// Without the shell's loop: reap our own tasks until all are done
+static void wait_for_tasks(parallel_run_t *run) {
+    while (run->running > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < run->nslots; i++) {
+            if (run->slots[i].pid == pid) {
+                task_finished(&run->slots[i], status);
+                break;
+            }
+        }
+    }
+}
+
+void parallel_command(int argc, char **argv) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    long jobs = cpus > 0 ? cpus : 1;
+    int first = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-j") == 0) {
+        char *end;
+        jobs = strtol(argv[2], &end, 10);
+        if (*argv[2] == '\0' || *end != '\0' || jobs < 1 || jobs > PARALLEL_MAX_SLOTS) {
+            fprintf(stderr, "parallel: invalid slot count: %s\n", argv[2]);
+            return;
+        }
+        first = 3;
+    }
+    // The arguments are read to EOF inside the shell with SIGINT held for the
+    // event loop, so at a terminal Ctrl-C would do nothing until Ctrl-D: take
+    // them from a file or a pipe only
+    if (first >= argc || isatty(STDIN_FILENO)) {
+        fprintf(stderr, "Usage: parallel [-j N] cmd [args...] < arguments\n");
+        return;
+    }
+
+    parallel_run_t *run = calloc(1, sizeof(parallel_run_t));
+    if (!run) {
+        perror("parallel");
+        return;
+    }
+    run->stdout_fd = -1;
+    run->nwords = argc - first;
+    run->words = calloc((size_t)run->nwords + 1, sizeof(char *));
+    for (int i = 0; run->words && i < run->nwords; i++) {
+        if (!(run->words[i] = strdup(argv[first + i]))) {
+            run->nwords = i;
+            free_run(run);
+            perror("parallel");
+            return;
+        }
+    }
+    fflush(stdout);
+    run->stdout_fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+    if (!run->words || run->stdout_fd == -1 || read_tasks(run) == -1 ||
+        make_slots(run, (int)jobs) == -1) {
+        perror("parallel");
+        free_run(run);
+        return;
+    }
+    if (run->ntasks == 0) {
+        free_run(run);
+        return;
+    }
+    run->owned = loop_is_owner();
+
+    for (int i = 0; i < run->nslots; i++) {
+        start_task(&run->slots[i]);
+    }
+    if (!run->owned) {
+        wait_for_tasks(run);
+    }
+    if (run->running == 0) {
+        finish_run(run); // all done, or nothing could be started
+    }
+}
@@ -1,10 +1,23 @@
 #include "shell.h"
+#include "ast.h"
+#include "arena.h"
 
 // Parser state structure
 typedef struct {
     const char *input;
     int pos;
     int len;
+    int tok_start; // span of the last name parsed
+    int tok_len;
+    char quote; // open ' or " (operators inside are part of a name), 0 = none
+    // AST being built, NULL when only validating
+    shell_ast_t *ast;
+    arena_t *arena; // owns every node of ast
+    pipeline_t *cur_pipeline;
+    atomic_t *cur_atomic;
+    redirect_t *last_redirect;
+    int argv_cap;
+    int oom;
 } parser_state_t;
 // same as prompt.c idk why the dupe happened aahhhh
 
@@ -19,20 +32,34 @@ static int parse_atomic(parser_state_t *state);
 static int parse_cmd_group(parser_state_t *state);
 static int parse_shell_cmd(parser_state_t *state);
 
+// AST building - every helper is a no-op when state->ast is NULL
+static int ast_begin_pipeline(parser_state_t *state);
+static int ast_begin_atomic(parser_state_t *state);
+static int ast_add_word(parser_state_t *state);
+static int ast_add_redirect(parser_state_t *state, redirect_type_t type);
+static void ast_mark_background(parser_state_t *state);
+
+static void init_state(parser_state_t *state, const char *input, shell_ast_t *ast, arena_t *arena) {
+    memset(state, 0, sizeof(*state));
+    state->input = input;
+    state->len = strlen(input);
+    state->ast = ast;
+    state->arena = arena;
+}
+
 int parse_command(const char *input) {
     return is_valid_shell_cmd(input);
 }
 
-int is_valid_shell_cmd(const char *input) {
+// Validate input against the grammar, optionally building its AST on the way
+static int parse_line(const char *input, shell_ast_t *ast, arena_t *arena) {
     if (!input || strlen(input) == 0) {
         return 0;
     }
     
     // Create parser state
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, ast, arena);
     
     // Skip initial whitespace
     skip_ws(&state);
@@ -47,7 +74,21 @@ int is_valid_shell_cmd(const char *input) {
     
     // Should consume entire input
     skip_ws(&state);
-    return result && (state.pos >= state.len);
+    return result && !state.oom && (state.pos >= state.len);
+}
+
+int is_valid_shell_cmd(const char *input) {
+    return parse_line(input, NULL, NULL);
+}
+
+// Parse input into an AST in one pass, allocating every node from arena.
+// Returns NULL on invalid syntax; whatever was allocated goes with the arena.
+shell_ast_t *parse_shell_ast(const char *input, arena_t *arena) {
+    shell_ast_t *ast = arena_calloc(arena, 1, sizeof(shell_ast_t));
+    if (!ast || !parse_line(input, ast, arena)) {
+        return NULL;
+    }
+    return ast;
 }
 
 // Parse shell_cmd -> cmd_group ((& | ;) cmd_group)* &?
@@ -65,6 +106,9 @@ static int parse_shell_cmd(parser_state_t *state) {
         if (peek_char(state) == '&' || peek_char(state) == ';') {
             char separator = consume_char(state);
             skip_ws(state);
+            if (separator == '&') {
+                ast_mark_background(state);
+            }
             
             // If we just have & at the end, that's valid (background)
             if (separator == '&' && state->pos >= state->len) {
@@ -84,6 +128,7 @@ static int parse_shell_cmd(parser_state_t *state) {
     skip_ws(state);
     if (peek_char(state) == '&') {
         consume_char(state);
+        ast_mark_background(state);
     }
     
     return 1;
@@ -91,6 +136,9 @@ static int parse_shell_cmd(parser_state_t *state) {
 
 // Parse cmd_group -> atomic (| atomic)*
 static int parse_cmd_group(parser_state_t *state) {
+    if (!ast_begin_pipeline(state)) {
+        return 0;
+    }
     // Parse first atomic (required)
     if (!parse_atomic(state)) {
         return 0;
@@ -122,6 +170,9 @@ static int parse_atomic(parser_state_t *state) {
     if (!parse_name(state)) {
         return 0;
     }
+    if (!ast_begin_atomic(state) || !ast_add_word(state)) {
+        return 0;
+    }
     
     // Parse optional (name | input | output)*
     while (1) {
@@ -129,16 +180,19 @@ static int parse_atomic(parser_state_t *state) {
         skip_ws(state);
         
         // Try to parse input redirection
-        if (peek_char(state) == '<') {
+        if (peek_char(state) == '<' && !state->quote) {
             if (parse_input_redirect(state)) {
+                if (!ast_add_redirect(state, REDIR_INPUT)) return 0;
                 continue;
             }
             state->pos = saved_pos;
         }
         
         // Try to parse output redirection
-        if (peek_char(state) == '>') {
+        if (peek_char(state) == '>' && !state->quote) {
+            int append = state->pos + 1 < state->len && state->input[state->pos + 1] == '>';
             if (parse_output_redirect(state)) {
+                if (!ast_add_redirect(state, append ? REDIR_APPEND : REDIR_OUTPUT)) return 0;
                 continue;
             }
             state->pos = saved_pos;
@@ -146,6 +200,7 @@ static int parse_atomic(parser_state_t *state) {
         
         // Try to parse another name (argument)
         if (parse_name(state)) {
+            if (!ast_add_word(state)) return 0;
             continue;
         }
         
@@ -158,6 +213,9 @@ static int parse_atomic(parser_state_t *state) {
 }
 
 // Parse name -> [^|&><;]+
+// Between matching quotes | & > < ; are ordinary characters. The quotes stay
+// part of the words and whitespace still separates words, so the quote state
+// carries over from one name to the next
 static int parse_name(parser_state_t *state) {
     skip_ws(state);
     int start_pos = state->pos;
@@ -165,13 +223,22 @@ static int parse_name(parser_state_t *state) {
     // Parse characters that are not special operators
     while (state->pos < state->len) {
         char c = peek_char(state);
-        if (c == '|' || c == '&' || c == '>' || c == '<' || c == ';' || isspace(c)) {
+        if (isspace(c) || (!state->quote && (c == '|' || c == '&' || c == '>' || c == '<' || c == ';'))) {
             break;
         }
+        if (c == '\'' || c == '"') {
+            if (!state->quote) {
+                state->quote = c;
+            } else if (c == state->quote) {
+                state->quote = 0;
+            }
+        }
         consume_char(state);
     }
     
     // Must have consumed at least one character
+    state->tok_start = start_pos;
+    state->tok_len = state->pos - start_pos;
     return state->pos > start_pos;
 }
 
@@ -228,12 +295,99 @@ static void skip_ws(parser_state_t *state) {
     }
 }
 
+// AST helper implementations
+static int ast_begin_pipeline(parser_state_t *state) {
+    if (!state->ast) return 1;
+    pipeline_t *p = arena_calloc(state->arena, 1, sizeof(pipeline_t));
+    if (!p) {
+        state->oom = 1;
+        return 0;
+    }
+    if (state->cur_pipeline) {
+        state->cur_pipeline->next = p;
+    } else {
+        state->ast->pipelines = p;
+    }
+    state->ast->npipelines++;
+    state->cur_pipeline = p;
+    state->cur_atomic = NULL;
+    return 1;
+}
+
+static int ast_begin_atomic(parser_state_t *state) {
+    if (!state->ast) return 1;
+    atomic_t *a = arena_calloc(state->arena, 1, sizeof(atomic_t));
+    if (!a) {
+        state->oom = 1;
+        return 0;
+    }
+    if (state->cur_atomic) {
+        state->cur_atomic->next = a;
+    } else {
+        state->cur_pipeline->stages = a;
+    }
+    state->cur_pipeline->nstages++;
+    state->cur_atomic = a;
+    state->last_redirect = NULL;
+    state->argv_cap = 0;
+    return 1;
+}
+
+// Append the last parsed name to the current atomic's argv
+static int ast_add_word(parser_state_t *state) {
+    if (!state->ast) return 1;
+    atomic_t *a = state->cur_atomic;
+    if (a->argc + 2 > state->argv_cap) {
+        int cap = state->argv_cap ? state->argv_cap * 2 : 8;
+        char **grown = arena_alloc(state->arena, (size_t)cap * sizeof(char*));
+        if (!grown) {
+            state->oom = 1;
+            return 0;
+        }
+        if (a->argc > 0) {
+            memcpy(grown, a->argv, (size_t)a->argc * sizeof(char*));
+        }
+        a->argv = grown;
+        state->argv_cap = cap;
+    }
+    char *word = arena_strndup(state->arena, state->input + state->tok_start, (size_t)state->tok_len);
+    if (!word) {
+        state->oom = 1;
+        return 0;
+    }
+    a->argv[a->argc++] = word;
+    a->argv[a->argc] = NULL;
+    return 1;
+}
+
+// Record a redirection whose target is the last parsed name
+static int ast_add_redirect(parser_state_t *state, redirect_type_t type) {
+    if (!state->ast) return 1;
+    redirect_t *r = arena_calloc(state->arena, 1, sizeof(redirect_t));
+    if (!r || !(r->target = arena_strndup(state->arena, state->input + state->tok_start, (size_t)state->tok_len))) {
+        state->oom = 1;
+        return 0;
+    }
+    r->type = type;
+    if (state->last_redirect) {
+        state->last_redirect->next = r;
+    } else {
+        state->cur_atomic->redirects = r;
+    }
+    state->last_redirect = r;
+    return 1;
+}
+
+static void ast_mark_background(parser_state_t *state) {
+    if (state->ast && state->cur_pipeline) {
+        state->cur_pipeline->background = 1;
+    }
+}
+
 // Legacy functions (kept for compatibility)
 int is_valid_cmd_group(const char *input) {
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, NULL, NULL);
     skip_ws(&state);
     
     int result = parse_cmd_group(&state);
@@ -243,9 +397,7 @@ int is_valid_cmd_group(const char *input) {
 
 int is_valid_atomic(const char *input) {
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, NULL, NULL);
     skip_ws(&state);
     
     int result = parse_atomic(&state);
@@ -259,9 +411,7 @@ int is_valid_name(const char *input) {
     }
     
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, NULL, NULL);
     skip_ws(&state);
     
     int result = parse_name(&state);
@@ -275,9 +425,7 @@ int is_valid_input_redirect(const char *input) {
     }
     
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, NULL, NULL);
     skip_ws(&state);
     
     int result = parse_input_redirect(&state);
@@ -291,9 +439,7 @@ int is_valid_output_redirect(const char *input) {
     }
     
     parser_state_t state;
-    state.input = input;
-    state.pos = 0;
-    state.len = strlen(input);
+    init_state(&state, input, NULL, NULL);
     skip_ws(&state);
     
     int result = parse_output_redirect(&state);
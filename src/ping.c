@@ -1,4 +1,6 @@
 #include "shell.h"
+#include "launch.h"
+#include "bg_jobs.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,21 +36,30 @@ void ping(int argc, char **argv) {
     // Take signal number modulo 32 as required
     int actual_signal = (int)(signal_long % 32);
     
-    // Check if process exists by sending signal 0 (doesn't actually send a signal)
-    if (kill(pid, 0) == -1) { // returns 0 if process exists and allows signalling and -1 if no process exists and sets errno
+    // Signal through a pidfd: it stays bound to this process even if pid is
+    // reused meanwhile. Jobs already have one; other processes get a short-lived one
+    job_proc_t *proc = find_job_proc(pid);
+    int pidfd = proc ? proc->pidfd : -1;
+    int own_pidfd = -1;
+    if (pidfd == -1) {
+        pidfd = own_pidfd = open_pidfd(pid);
+        if (pidfd == -1 && errno == ESRCH) {
+            printf("No such process found\n");
+            return;
+        }
+    }
+
+    // Send the actual signal (kill() by pid if pidfds are unavailable)
+    if (signal_process(pidfd, pid, actual_signal) == -1) {
         if (errno == ESRCH) {
             printf("No such process found\n");
         } else {
-            perror("ping");
+            perror("ping"); // permission denied
         }
+        if (own_pidfd != -1) close(own_pidfd);
         return;
     }
-    
-    // Send the actual signal
-    if (kill(pid, actual_signal) == -1) {
-        perror("ping"); // permission denied
-        return;
-    }
+    if (own_pidfd != -1) close(own_pidfd);
     
     // Success message
     printf("Sent signal %d to process with pid %d\n", actual_signal, pid);
@@ -0,0 +1,150 @@
+#include "shell.h"
+#include "ast.h"
+#include "arena.h"
+#include <stdint.h>
+
+// LRU cache of parsed command lines: a line that is run again (scripts,
+// log execute) reuses its AST instead of being parsed from scratch.
+// Each entry keeps its AST in its own arena; a plan is never modified by the executor.
+// A miss is parsed into a spare arena first, so a line with invalid syntax
+// neither takes a slot nor evicts a plan that is still good.
+
+#define PLAN_CACHE_SIZE 16
+#define PLAN_ARENA_BLOCK 1024
+
+struct plan_entry {
+    uint64_t key;          // hash of line
+    char *line;            // copy of the line, to confirm a hash match
+    shell_ast_t *ast;
+    arena_t arena;
+    unsigned long last_used;
+    unsigned hits;
+    int pins;              // executions currently walking ast
+    int valid;
+};
+
+static plan_entry_t plan_cache[PLAN_CACHE_SIZE];
+static arena_t spare;      // the next miss is parsed here, then swapped into its entry
+static unsigned long use_clock = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+static uint64_t hash_line(const char *s) {
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Least recently used entry that nobody is executing, or NULL if all are busy
+static plan_entry_t *pick_victim(void) {
+    plan_entry_t *victim = NULL;
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        plan_entry_t *e = &plan_cache[i];
+        if (e->pins > 0) continue;
+        if (!e->valid) return e;
+        if (!victim || e->last_used < victim->last_used) victim = e;
+    }
+    return victim;
+}
+
+// Get the plan for input, parsing it on a miss. The entry stays pinned (safe from
+// eviction, e.g. by a nested log execute) until plan_release().
+// If every entry is pinned the line is parsed into fallback and not cached.
+// Returns NULL on invalid syntax.
+shell_ast_t *plan_acquire(const char *input, arena_t *fallback, plan_entry_t **entry_out) {
+    uint64_t key = hash_line(input);
+    *entry_out = NULL;
+
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        plan_entry_t *e = &plan_cache[i];
+        if (e->valid && e->key == key && strcmp(e->line, input) == 0) {
+            e->last_used = ++use_clock;
+            e->hits++;
+            e->pins++;
+            cache_hits++;
+            *entry_out = e;
+            return e->ast;
+        }
+    }
+
+    cache_misses++;
+    plan_entry_t *e = pick_victim();
+    if (!e) {
+        return parse_shell_ast(input, fallback);
+    }
+    if (!spare.block_size) {
+        arena_init(&spare, PLAN_ARENA_BLOCK);
+    }
+    shell_ast_t *ast = parse_shell_ast(input, &spare);
+    char *line = ast ? arena_strndup(&spare, input, strlen(input)) : NULL;
+    if (!line) {
+        arena_reset(&spare);
+        return NULL;
+    }
+
+    // Parsed: the victim's arena becomes the spare one
+    arena_t old = e->arena;
+    e->arena = spare;
+    spare = old;
+    arena_reset(&spare);
+    e->key = key;
+    e->line = line;
+    e->ast = ast;
+    e->last_used = ++use_clock;
+    e->hits = 0;
+    e->pins = 1;
+    e->valid = 1;
+    *entry_out = e;
+    return ast;
+}
+
+void plan_release(plan_entry_t *entry) {
+    if (entry && entry->pins > 0) {
+        entry->pins--;
+    }
+}
+
+static void clear_plans(void) {
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        plan_entry_t *e = &plan_cache[i];
+        if (e->pins > 0) continue;
+        arena_destroy(&e->arena);
+        e->arena.block_size = 0;
+        e->valid = 0;
+    }
+    if (spare.block_size) {
+        arena_destroy(&spare);
+        spare.block_size = 0;
+    }
+}
+
+// plancache      show hit/miss counters and the cached lines
+// plancache -c   drop every cached plan and reset the counters
+void plancache_command(int argc, char **argv) {
+    if (argc == 2 && strcmp(argv[1], "-c") == 0) {
+        clear_plans();
+        cache_hits = 0;
+        cache_misses = 0;
+        return;
+    }
+    if (argc != 1) {
+        fprintf(stderr, "Usage: plancache [-c]\n");
+        return;
+    }
+
+    unsigned long lookups = cache_hits + cache_misses;
+    printf("hits: %lu misses: %lu", cache_hits, cache_misses);
+    if (lookups > 0) {
+        printf(" (%.1f%% hit rate)", 100.0 * (double)cache_hits / (double)lookups);
+    }
+    printf("\n");
+    for (int i = 0; i < PLAN_CACHE_SIZE; i++) {
+        if (plan_cache[i].valid) {
+            printf("%4u\t%s\n", plan_cache[i].hits, plan_cache[i].line);
+        }
+    }
+    fflush(stdout);
+}
@@ -1,5 +1,7 @@
 #include "shell.h"
 #include "bg_jobs.h"
+#include "eventloop.h"
+#include "history.h"
 #include <signal.h> // handles ctrl c ctrl d ctrl z etc.
 #include <termios.h>
 #include <pwd.h>
@@ -11,6 +13,7 @@ int main(void) {
 // signal(SIGTSTP, SIG_IGN);
 signal(SIGTTIN, SIG_IGN); // sent when bg process tries to r/w to terminal
 signal(SIGTTOU, SIG_IGN); // are ignored so shell remains in control of terminal i/o + does not stop
+signal(SIGPIPE, SIG_IGN); // a built-in stage writing to a closed pipe gets EPIPE instead of killing the shell
 char input[MAX_INPUT_SIZE]; // input buffer 
 char spawn_cwd[PATH_MAX]; // working dir current
 if (getcwd(spawn_cwd, sizeof(spawn_cwd))) {
@@ -34,16 +37,20 @@ if (!getenv("OLDPWD")) setenv("OLDPWD", cwd_buf, 1);
  } // gets all env variables regarding path and all
 init_bg_jobs(); 
 load_history(); // loads history (15 commands consistently stored accross all sessions)
-setup_signal_handling();
+if (loop_init() == -1) { // SIGINT/SIGTSTP/SIGCHLD are read from a signalfd from here on
+return 1;
+ }
 setpgid(0, 0); // puts shell process in its own process group
 tcsetpgrp(STDIN_FILENO, getpgrp()); // makes the shell process grp the foreground process grp for terminal
 while (1) {
-check_background_processes(); // cleans up bg processes
+loop_dispatch_pending(); // reports jobs that changed state while the last command ran
 display_prompt(); // displays prompt
+history_flush(); // journals the last line while the next one is typed
 // Handle EOF (Ctrl-D) detection
 if (get_user_input(input) == -1) {
 // fprintf(stderr, "DEBUG: EOF detected, printing logout\n"); // Debug to stderr
 printf("logout\n"); // logout on ctrl D
+history_flush();
 fflush(stdout); // cleanup
 fflush(stderr);
 cleanup_all_jobs(); // cleanup
@@ -58,15 +65,14 @@ trim_whitespace(input);
 if (strlen(input) == 0) {
 continue;
  }
-// Parse and validate command
-if (!parse_command(input)) {
-printf("Invalid Syntax!\n"); // put through parser and check for syntax
-add_to_history(input);
+// Parse (one pass, straight to an AST) and execute the command
+if (!execute_command(input)) {
+printf("Invalid Syntax!\n"); // parser rejected the syntax, nothing ran
+history_entry_t rejected = { 0, 0, 2, 0, NULL, 0, NULL, 0 }; // $? of a syntax error
+add_to_history(input, &rejected);
  } else {
-// Execute the command (now background-aware with signal handling)
-execute_command(input); // execute
 // Reap and print any background completions immediately
-check_background_processes(); // reaps bg processes - Double-checking ensures your shell updates job statuses as soon as commands finish.
+loop_dispatch_pending(); // report completions right after the command, before the next prompt
 fflush(stdout);
  }
  }
@@ -0,0 +1,356 @@
+#define _GNU_SOURCE
+#include "shell.h"
+#include "history.h"
+#include "trigram.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// File layout: a header, TRIGRAM_BUCKETS block numbers (the newest block of
+// each bucket, 0 = empty), then fixed-size blocks of record numbers. A bucket
+// is a chain of blocks linked newest to oldest, and record numbers only ever
+// grow, so walking a chain (each block backwards) yields them newest first.
+//
+// The index covers records [0, indexed) of the journal whose inode it names.
+// It is brought up to date under the history lock: incrementally after every
+// append once it exists, from scratch on the first search, after compaction
+// (which renumbers every record) and if an update was interrupted (dirty).
+
+#define TRIGRAM_BUCKETS 65536
+#define BLOCK_IDS 14
+#define GROW_BLOCKS 4096
+#define QUERY_TRIGRAMS 32     // buckets intersected per query at most
+
+static const char trigram_magic[8] = "SHTRI1\n";
+
+typedef struct {
+    char magic[8];
+    uint64_t journal_ino;
+    uint64_t indexed;         // records covered
+    uint32_t nblocks;         // blocks in use, block 0 included
+    uint32_t capacity;        // blocks the file has room for
+    uint32_t dirty;           // set while an update is under way
+    uint32_t reserved[7];
+} trigram_header_t;
+
+typedef struct {
+    uint32_t next;            // older block of the same bucket, 0 = none
+    uint32_t count;
+    uint32_t ids[BLOCK_IDS];  // ascending
+} trigram_block_t;
+
+#define BLOCKS_AT (sizeof(trigram_header_t) + TRIGRAM_BUCKETS * sizeof(uint32_t))
+
+static char tri_path[PATH_MAX + 8];
+static int tri_fd = -1;
+static char *tri_map = NULL;
+static size_t tri_mapped = 0;
+static trigram_header_t *header;
+static uint32_t *heads;
+static trigram_block_t *blocks;
+static int usable = 0;        // the index covers every record
+
+static unsigned bucket_of(const unsigned char *t) {
+    uint32_t v = (uint32_t)t[0] << 16 | (uint32_t)t[1] << 8 | t[2];
+    return (v * 2654435761u) >> 16; // Fibonacci hashing onto 16 bits
+}
+
+static void unmap_index(void) {
+    if (tri_map) munmap(tri_map, tri_mapped);
+    tri_map = NULL;
+    tri_mapped = 0;
+    usable = 0;
+}
+
+void trigram_close(void) {
+    unmap_index();
+    if (tri_fd != -1) close(tri_fd);
+    tri_fd = -1;
+}
+
+// Map the whole file (again, if another session has grown it)
+static int map_index(void) {
+    struct stat st;
+    if (fstat(tri_fd, &st) == -1) {
+        return -1;
+    }
+    if ((size_t)st.st_size == tri_mapped && tri_map) {
+        return 0;
+    }
+    unmap_index();
+    if ((size_t)st.st_size < BLOCKS_AT) {
+        return 0;
+    }
+    void *m = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, tri_fd, 0);
+    if (m == MAP_FAILED) {
+        return -1;
+    }
+    tri_map = m;
+    tri_mapped = (size_t)st.st_size;
+    header = (trigram_header_t *)tri_map;
+    heads = (uint32_t *)(tri_map + sizeof(trigram_header_t));
+    blocks = (trigram_block_t *)(tri_map + BLOCKS_AT);
+    return 0;
+}
+
+// Make room for capacity blocks
+static int resize_index(uint32_t capacity) {
+    if (ftruncate(tri_fd, (off_t)(BLOCKS_AT + (size_t)capacity * sizeof(trigram_block_t))) == -1 ||
+        map_index() == -1 || !tri_map) {
+        return -1;
+    }
+    header->capacity = capacity;
+    return 0;
+}
+
+// Start over, empty, for the journal with inode journal_ino
+static int reset_index(uint64_t journal_ino) {
+    unmap_index();
+    if (ftruncate(tri_fd, 0) == -1 || resize_index(GROW_BLOCKS) == -1) {
+        return -1;
+    }
+    memcpy(header->magic, trigram_magic, sizeof(header->magic));
+    header->journal_ino = journal_ino;
+    header->indexed = 0;
+    header->nblocks = 1;
+    return 0;
+}
+
+// File record number id under every distinct bucket of its trigrams
+static int add_record(uint32_t id, const unsigned char *text, size_t len) {
+    static uint64_t seen[TRIGRAM_BUCKETS / 64];
+    unsigned added[MAX_INPUT_SIZE];
+    int nadded = 0;
+
+    for (size_t i = 0; i + 3 <= len && nadded < MAX_INPUT_SIZE; i++) {
+        unsigned b = bucket_of(text + i);
+        if (seen[b / 64] & (1ULL << (b % 64))) {
+            continue;
+        }
+        seen[b / 64] |= 1ULL << (b % 64);
+        added[nadded++] = b;
+    }
+
+    int rc = 0;
+    for (int k = 0; k < nadded; k++) {
+        unsigned b = added[k];
+        seen[b / 64] &= ~(1ULL << (b % 64));
+        if (rc == -1) {
+            continue;
+        }
+        uint32_t head = heads[b];
+        if (head == 0 || blocks[head].count == BLOCK_IDS) {
+            if (header->nblocks == header->capacity &&
+                resize_index(header->capacity + header->capacity / 2) == -1) {
+                rc = -1;
+                continue;
+            }
+            uint32_t block = header->nblocks++;
+            blocks[block].next = head;
+            blocks[block].count = 0;
+            heads[b] = head = block;
+        }
+        blocks[head].ids[blocks[head].count++] = id;
+    }
+    return rc;
+}
+
+// Bring the index at path up to the history's first records records. An
+// index that does not exist yet or has to be rebuilt is only (re)built if
+// build is set. The history lock must be held. Returns -1 if the index cannot
+// be used
+int trigram_update(const char *path, uint64_t journal_ino, long records, int build) {
+    struct stat path_st, fd_st;
+    if (tri_fd != -1 && (strcmp(path, tri_path) != 0 || stat(path, &path_st) == -1 ||
+                         fstat(tri_fd, &fd_st) == -1 || path_st.st_ino != fd_st.st_ino)) {
+        trigram_close(); // removed by log purge
+    }
+    if (tri_fd == -1) {
+        if (snprintf(tri_path, sizeof(tri_path), "%s", path) >= (int)sizeof(tri_path)) {
+            return -1;
+        }
+        tri_fd = open(tri_path, O_RDWR | O_CLOEXEC | (build ? O_CREAT : 0), 0644);
+        if (tri_fd == -1) {
+            return -1;
+        }
+    }
+    usable = 0;
+    if (map_index() == -1) {
+        return -1;
+    }
+    if (!tri_map || memcmp(header->magic, trigram_magic, sizeof(header->magic)) != 0 ||
+        header->journal_ino != journal_ino || header->dirty || header->indexed > (uint64_t)records ||
+        tri_mapped < BLOCKS_AT + (size_t)header->capacity * sizeof(trigram_block_t)) {
+        if (!build || reset_index(journal_ino) == -1) {
+            return -1;
+        }
+    }
+
+    header->dirty = 1;
+    for (long n = (long)header->indexed; n < records; n++) {
+        history_entry_t entry;
+        if (history_read(n, &entry) == -1 ||
+            add_record((uint32_t)n, (const unsigned char *)entry.command, entry.command_len) == -1) {
+            return -1; // left dirty: rebuilt by the next search
+        }
+    }
+    header->indexed = (uint64_t)records;
+    header->dirty = 0;
+    usable = 1;
+    return 0;
+}
+
+// A query: a substring, or a glob pattern (* ? [...]) matched anywhere
+typedef struct {
+    const char *pattern;
+    size_t len;
+    char *glob;               // "*pattern*" for fnmatch, NULL for a substring
+    unsigned buckets[QUERY_TRIGRAMS];
+    int nbuckets;
+} query_t;
+
+// The trigrams a match must contain: those of the literal runs of the pattern
+static void query_trigrams(query_t *q) {
+    char run[MAX_INPUT_SIZE];
+    size_t len = 0;
+    for (const char *p = q->pattern;; p++) {
+        int literal = *p != '\0';
+        if (q->glob && (*p == '*' || *p == '?' || *p == '[')) {
+            literal = 0;
+            if (*p == '[') {
+                const char *close = p[1] ? strchr(p + 2, ']') : NULL; // "[]...]": ] is a member
+                p = close ? close : p + strlen(p) - 1;
+            }
+        } else if (q->glob && *p == '\\' && p[1]) {
+            p++;
+        }
+        if (literal && len < sizeof(run)) {
+            run[len++] = *p;
+            continue;
+        }
+        for (size_t i = 0; i + 3 <= len && q->nbuckets < QUERY_TRIGRAMS; i++) {
+            unsigned b = bucket_of((const unsigned char *)run + i);
+            int dup = 0;
+            for (int k = 0; k < q->nbuckets && !dup; k++) dup = q->buckets[k] == b;
+            if (!dup) q->buckets[q->nbuckets++] = b;
+        }
+        len = 0;
+        if (*p == '\0') break;
+    }
+}
+
+// Does record n match?
+static int record_matches(const query_t *q, long n) {
+    history_entry_t entry;
+    if (history_read(n, &entry) == -1) {
+        return 0;
+    }
+    if (!q->glob) {
+        return memmem(entry.command, entry.command_len, q->pattern, q->len) != NULL;
+    }
+    char command[MAX_INPUT_SIZE];
+    if (entry.command_len >= sizeof(command)) {
+        return 0;
+    }
+    memcpy(command, entry.command, entry.command_len);
+    command[entry.command_len] = '\0';
+    return fnmatch(q->glob, command, 0) == 0;
+}
+
+// Position in one bucket's chain, walking newest to oldest
+typedef struct {
+    uint32_t block;
+    int pos;
+} cursor_t;
+
+static uint32_t cursor_id(const cursor_t *c) {
+    return blocks[c->block].ids[c->pos];
+}
+
+static void cursor_next(cursor_t *c) {
+    if (--c->pos < 0) {
+        c->block = blocks[c->block].next;
+        c->pos = c->block ? (int)blocks[c->block].count - 1 : 0;
+    }
+}
+
+// Walk down to the first record below limit; returns 0 at the end of the chain
+static int cursor_below(cursor_t *c, uint32_t limit) {
+    while (c->block && cursor_id(c) >= limit) {
+        cursor_next(c);
+    }
+    return c->block != 0;
+}
+
+// Records below before that contain all of q's trigrams, newest first:
+// a leapfrog intersection of the buckets' chains
+static long search_index(const query_t *q, long before, long *matches, long max) {
+    cursor_t cursors[QUERY_TRIGRAMS];
+    for (int k = 0; k < q->nbuckets; k++) {
+        cursors[k].block = heads[q->buckets[k]];
+        cursors[k].pos = cursors[k].block ? (int)blocks[cursors[k].block].count - 1 : 0;
+    }
+
+    long found = 0;
+    uint32_t limit = (uint32_t)before; // candidates are below limit
+    while (found < max) {
+        if (!cursor_below(&cursors[0], limit)) break;
+        uint32_t candidate = cursor_id(&cursors[0]);
+        int k = 1;
+        for (; k < q->nbuckets; k++) {
+            if (!cursor_below(&cursors[k], candidate + 1)) {
+                return found;
+            }
+            if (cursor_id(&cursors[k]) != candidate) break;
+        }
+        if (k < q->nbuckets) {
+            limit = cursor_id(&cursors[k]) + 1; // nothing above that is in every bucket
+            continue;
+        }
+        if (record_matches(q, (long)candidate)) {
+            matches[found++] = (long)candidate;
+        }
+        limit = candidate;
+    }
+    return found;
+}
+
+// Up to max records below before (history_count() for the newest) matching
+// pattern, newest first, into matches. Repeating the call with before set to
+// the last match steps back through older ones, as reverse incremental
+// search does. Without a usable index, or for a pattern with no trigram,
+// records are checked one by one
+long trigram_search(const char *pattern, long before, long *matches, long max) {
+    query_t q;
+    memset(&q, 0, sizeof(q));
+    q.pattern = pattern;
+    q.len = strlen(pattern);
+    if (strpbrk(pattern, "*?[")) {
+        q.glob = malloc(q.len + 3);
+        if (!q.glob) return 0;
+        snprintf(q.glob, q.len + 3, "*%s*", pattern);
+    }
+    query_trigrams(&q);
+    if (before > history_count()) {
+        before = history_count();
+    }
+
+    long found = 0;
+    if (usable && q.nbuckets > 0) {
+        found = search_index(&q, before, matches, max);
+    } else {
+        for (long n = before - 1; n >= 0 && found < max; n--) {
+            if (record_matches(&q, n)) {
+                matches[found++] = n;
+            }
+        }
+    }
+    free(q.glob);
+    return found;
+}
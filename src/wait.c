@@ -0,0 +1,143 @@
+#include "shell.h"
+#include "bg_jobs.h"
+#include "eventloop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+// wait           block until every running or queued job has finished
+// wait <job>     block until job <job> (or %<job>) has finished, print its status
+// wait -n        block until the next job finishes, print its status
+//
+// Nothing is polled: the shell's event loop runs as usual (reaping, printing
+// completions) and wait returns as soon as the job table says it is done.
+// Only wait's own lines go to its stdout; with wait > f the completion
+// notices printed meanwhile still go to the shell's stdout (set_shell_stdout).
+// Ctrl-C gives up waiting. The status printed is a shell's exit status: the
+// last stage's exit code, or 128 + the signal that killed it.
+
+static int exit_code(int wait_status) {
+    if (WIFSIGNALED(wait_status)) {
+        return 128 + WTERMSIG(wait_status);
+    }
+    return WEXITSTATUS(wait_status);
+}
+
+static void print_result(const job_result_t *result) {
+    char usage[160];
+    format_usage(&result->usage, usage, sizeof(usage));
+    printf("[%d] %s: exit %d%s [%s]\n", result->job_id, result->command,
+           exit_code(result->wait_status), result->timed_out ? " (timed out)" : "", usage);
+}
+
+// loop_done_fn: job *arg is gone or stopped
+static int job_settled(void *arg) {
+    bg_job_t *job = find_job_by_number(*(int *)arg);
+    return !job || job->status == JOB_STOPPED;
+}
+
+// loop_done_fn: a job completed after completion *arg, or none is left to
+static int next_completed(void *arg) {
+    return last_result_seq() != *(unsigned long *)arg || !jobs_pending();
+}
+
+// loop_done_fn: nothing left that finishes by itself
+static int all_settled(void *arg) {
+    (void)arg;
+    return !jobs_pending();
+}
+
+static void wait_job(int job_id) {
+    bg_job_t *job = find_job_by_number(job_id);
+    if (job && job->status != JOB_STOPPED && loop_wait_until(job_settled, &job_id) == -1) {
+        printf("wait: interrupted\n");
+        return;
+    }
+    job = find_job_by_number(job_id);
+    if (job) {
+        printf("wait: job %d is stopped\n", job_id);
+        return;
+    }
+    const job_result_t *result = find_job_result(job_id);
+    if (!result) {
+        printf("wait: no such job: %d\n", job_id);
+        return;
+    }
+    print_result(result);
+}
+
+static void wait_any(void) {
+    unsigned long seen = last_result_seq();
+    if (!jobs_pending()) {
+        printf("wait: no running jobs\n");
+        return;
+    }
+    if (loop_wait_until(next_completed, &seen) == -1) {
+        printf("wait: interrupted\n");
+        return;
+    }
+    const job_result_t *result = job_result(seen + 1);
+    if (result) {
+        print_result(result);
+    } else {
+        printf("wait: no running jobs\n");
+    }
+}
+
+// Sum up the jobs that completed while waiting (as far as they are still kept)
+static void wait_all(void) {
+    unsigned long first = last_result_seq() + 1;
+    int interrupted = loop_wait_until(all_settled, NULL) == -1;
+
+    int done = 0, failed = 0;
+    job_usage_t total;
+    memset(&total, 0, sizeof(total));
+    for (unsigned long seq = first; seq <= last_result_seq(); seq++) {
+        const job_result_t *result = job_result(seq);
+        if (!result) {
+            continue;
+        }
+        done++;
+        failed += exit_code(result->wait_status) != 0 || result->timed_out;
+        total.utime.tv_sec += result->usage.utime.tv_sec;
+        total.utime.tv_usec += result->usage.utime.tv_usec;
+        total.stime.tv_sec += result->usage.stime.tv_sec;
+        total.stime.tv_usec += result->usage.stime.tv_usec;
+    }
+    total.utime.tv_sec += total.utime.tv_usec / 1000000;
+    total.utime.tv_usec %= 1000000;
+    total.stime.tv_sec += total.stime.tv_usec / 1000000;
+    total.stime.tv_usec %= 1000000;
+
+    if (interrupted) {
+        printf("wait: interrupted, ");
+    } else if (done > 0) {
+        printf("wait: ");
+    } else {
+        return;
+    }
+    printf("%d jobs done, %d failed (user %ld.%02lds sys %ld.%02lds)\n", done, failed,
+           (long)total.utime.tv_sec, (long)total.utime.tv_usec / 10000,
+           (long)total.stime.tv_sec, (long)total.stime.tv_usec / 10000);
+}
+
+void wait_command(int argc, char **argv) {
+    if (argc == 1) {
+        wait_all();
+    } else if (argc == 2 && strcmp(argv[1], "-n") == 0) {
+        wait_any();
+    } else if (argc == 2) {
+        const char *arg = argv[1][0] == '%' ? argv[1] + 1 : argv[1];
+        char *end;
+        long job_id = strtol(arg, &end, 10);
+        if (*arg == '\0' || *end != '\0' || job_id <= 0) {
+            printf("Invalid job number: %s\n", argv[1]);
+            return;
+        }
+        wait_job((int)job_id);
+    } else {
+        printf("Usage: wait [-n | job_number]\n");
+    }
+    fflush(stdout);
+}
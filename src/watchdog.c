@@ -0,0 +1,137 @@
+#include "shell.h"
+#include "watchdog.h"
+#include "eventloop.h"
+#include "launch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+
+#define DEFAULT_GRACE_MS 5000
+
+enum { WATCH_ARMED, WATCH_TERMINATED, WATCH_KILLED };
+
+struct job_watchdog {
+    pid_t pgid;
+    unsigned long timeout_ms;
+    unsigned long grace_ms;    // 0: never escalate to SIGKILL
+    loop_timer_t *timer;       // pending deadline, NULL once nothing is left to do
+    int stage;
+};
+
+static const char timeout_usage[] = "Usage: timeout [-k grace] duration cmd [args...]\n";
+
+// The deadline (or the grace period after it) is up
+static int watchdog_fire(void *arg) {
+    job_watchdog_t *watchdog = arg;
+    watchdog->timer = NULL; // freed by the loop
+
+    if (watchdog->stage == WATCH_ARMED) {
+        watchdog->stage = WATCH_TERMINATED;
+        signal_group(-1, watchdog->pgid, SIGTERM);
+        signal_group(-1, watchdog->pgid, SIGCONT); // a stopped job would never see it
+        if (watchdog->grace_ms > 0) {
+            watchdog->timer = loop_add_timer(watchdog->grace_ms, watchdog_fire, watchdog);
+        }
+    } else {
+        watchdog->stage = WATCH_KILLED;
+        signal_group(-1, watchdog->pgid, SIGKILL);
+    }
+    return 0;
+}
+
+// Watch process group pgid. NULL if no timer can be set (e.g. in a forked child)
+job_watchdog_t *watchdog_start(pid_t pgid, unsigned long timeout_ms, unsigned long grace_ms) {
+    job_watchdog_t *watchdog = malloc(sizeof(job_watchdog_t));
+    if (!watchdog) {
+        return NULL;
+    }
+    watchdog->pgid = pgid;
+    watchdog->timeout_ms = timeout_ms;
+    watchdog->grace_ms = grace_ms;
+    watchdog->stage = WATCH_ARMED;
+    watchdog->timer = loop_add_timer(timeout_ms, watchdog_fire, watchdog);
+    if (!watchdog->timer) {
+        free(watchdog);
+        return NULL;
+    }
+    return watchdog;
+}
+
+// Did the deadline pass (the job was then signalled)?
+int watchdog_expired(const job_watchdog_t *watchdog) {
+    return watchdog && watchdog->stage != WATCH_ARMED;
+}
+
+// "timed out after 2.5s", plus ", killed" once SIGKILL was needed
+int format_timeout(const job_watchdog_t *watchdog, char *buf, size_t size) {
+    return snprintf(buf, size, "timed out after %lu.%lus%s",
+                    watchdog->timeout_ms / 1000, watchdog->timeout_ms % 1000 / 100,
+                    watchdog->stage == WATCH_KILLED ? ", killed" : "");
+}
+
+// The job is over: its process group may be reused, so no signal may follow
+void watchdog_release(job_watchdog_t *watchdog) {
+    if (!watchdog) {
+        return;
+    }
+    loop_cancel_timer(watchdog->timer);
+    free(watchdog);
+}
+
+// 10, 2.5s, 500ms, 3m, 1h, 1d in ms. Returns -1 on a malformed duration
+static int parse_duration(const char *s, unsigned long *ms) {
+    char *end;
+    double value = strtod(s, &end);
+    if (end == s || value < 0) {
+        return -1;
+    }
+    double scale = 1000;
+    if (strcmp(end, "ms") == 0) scale = 1;
+    else if (strcmp(end, "m") == 0) scale = 60 * 1000;
+    else if (strcmp(end, "h") == 0) scale = 3600 * 1000;
+    else if (strcmp(end, "d") == 0) scale = 86400 * 1000;
+    else if (*end != '\0' && strcmp(end, "s") != 0) return -1;
+
+    double total = value * scale;
+    if (total > 1e12) {
+        return -1;
+    }
+    *ms = (unsigned long)total;
+    return 0;
+}
+
+// Parse "timeout [-k grace] duration cmd ...". Returns the index of cmd in
+// argv, or -1 (after printing why) on a malformed prefix. A duration of 0
+// means no deadline
+int parse_timeout(int argc, char **argv, unsigned long *timeout_ms, unsigned long *grace_ms) {
+    int i = 1;
+    *grace_ms = DEFAULT_GRACE_MS;
+    if (i < argc && strcmp(argv[i], "-k") == 0) {
+        if (i + 1 >= argc || parse_duration(argv[i + 1], grace_ms) == -1) {
+            fprintf(stderr, "timeout: invalid grace period: %s\n", i + 1 < argc ? argv[i + 1] : "");
+            return -1;
+        }
+        i += 2;
+    }
+    if (i >= argc) {
+        fprintf(stderr, "%s", timeout_usage);
+        return -1;
+    }
+    if (parse_duration(argv[i], timeout_ms) == -1) {
+        fprintf(stderr, "timeout: invalid duration: %s\n", argv[i]);
+        return -1;
+    }
+    if (++i >= argc) {
+        fprintf(stderr, "%s", timeout_usage);
+        return -1;
+    }
+    return i;
+}
+
+// Like limit, timeout is a prefix the executor applies to a whole cmd_group
+void timeout_command(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    fprintf(stderr, "timeout: must start a command (timeout duration cmd | ...)\n");
+}